@@ -19,11 +19,52 @@ Replaced "copy-paste" logic with functional blocks by use of arrays and loops
 
 ===========================================================================
 */
+#include <math.h>
+#include <new>
+#include <mutex>
 #include <Particle.h>
 #include "beam.h"
-#include "charactermap.h"
+#include "beamsync.h"
+#include "beamrender.h"
 #include "frames.h"
 
+// frameList in CS words, converted by the compiler and kept in flash
+static constexpr BeamFrames drawFrames = beamConvertFrames(frameList);
+
+// clock of each BEAM_CLOCK step
+static const uint32_t clockSteps[] = { 100000, 400000, 1000000 };
+
+// operations of the async engine
+enum BEAM_OP {
+  OP_FRAME = 0,   // flush dirty bytes of shadow frame reg
+  OP_CTRL  = 1,   // write data to CTRL register reg
+  OP_SETS  = 2,   // load the blink/PWM sets
+  OP_RESET = 3,   // pulse the reset line
+  OP_PLAY  = 4,   // hand over between daisy chained beams
+  OP_DONE  = 5,   // report job reg to the completion callback
+  OP_PWM   = 6,   // flush changed PWM bytes of set reg
+  OP_BANK  = 7,   // switch to bank reg once it is uploaded
+};
+
+/*
+Times a public operation for the latency histograms. Operations calling
+each other (e.g. print(text) -> print(image) -> initBeam()) count once.
+*/
+class BeamOpTimer {
+public:
+  BeamOpTimer(Beam &beam, uint8_t job) : _beam(beam), _job(job), _start(micros()) {
+    _beam._opDepth++;
+  }
+  ~BeamOpTimer() {
+    if (--_beam._opDepth == 0) _beam.recordLatency(_job, micros() - _start);
+  }
+
+private:
+  Beam    &_beam;
+  uint8_t  _job;
+  uint32_t _start;
+};
+
 /*
 =================
 PUBLIC FUNCTIONS
@@ -34,17 +75,23 @@ PUBLIC FUNCTIONS
 This constructor used when multiple Beams behave like one long Beam
 */
 Beam::Beam(int rstpin, int irqpin, int numberOfBeams) {
-  Log.trace("Beam::Beam(int rstpin, int irqpin, int numberOfBeams)");
+  BEAM_TRACE_CALL("Beam::Beam(int rstpin, int irqpin, int numberOfBeams)");
+  init();
   _rst = rstpin;
   _irq = irqpin;
 
-  if (numberOfBeams <= 0 || 4 <= numberOfBeams) {
-    Log.warn("Number of Beams must be between 1 and 4 and not %d (default to 1 BEAMA)", numberOfBeams);
+  if (numberOfBeams <= 0 || MAXBEAMS < numberOfBeams) {
+    Log.warn("Number of Beams must be between 1 and %d and not %d (default to 1 BEAMA)", MAXBEAMS, numberOfBeams);
     numberOfBeams = 1;
   }
-  BEAM = &BEAM_ADDRESS[0];
   activeBeams = 
   _beamCount = numberOfBeams;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    _port[b].wire = &Wire;
+    _port[b].bus = 0;
+    _port[b].channel = BEAM_NO_CHANNEL;
+    _port[b].addr = BEAM_ADDRESS[b % BEAM_PER_BUS];
+  }
   _gblMode = 1;
 }
 
@@ -52,327 +99,831 @@ Beam::Beam(int rstpin, int irqpin, int numberOfBeams) {
 This constructor used when multiple Beams behave like single Beam units
 */
 Beam::Beam(int rstpin, int irqpin, uint8_t syncMode, uint8_t beamAddress) {
-  Log.trace("Beam::Beam(int rstpin, int irqpin, uint8_t syncMode, uint8_t beamAddress)");
+  BEAM_TRACE_CALL("Beam::Beam(int rstpin, int irqpin, uint8_t syncMode, uint8_t beamAddress)");
+  init();
   _rst = rstpin;
   _irq = irqpin;
-  _syncMode = 0;
+  if (syncMode <= SYNC_SLAVE) {
+    _syncMode = syncMode;
+  }
+  else {
+    Log.warn("Select SYNC_OFF, SYNC_MASTER or SYNC_SLAVE for the clock sync line");
+  }
   _beamCount = 
   activeBeams = 1;
-  BEAM = NULL;
+  _port[0].wire = &Wire;
+  _port[0].bus = 0;
+  _port[0].channel = BEAM_NO_CHANNEL;
+  _port[0].addr = 0;
   for (unsigned int b = 0; b < sizeof(BEAM_ADDRESS); b++) {
     if (BEAM_ADDRESS[b] == beamAddress) {
-      BEAM = &BEAM_ADDRESS[b];
+      _port[0].addr = beamAddress;
       break;
     }
   }
-  if (!BEAM) {
-    BEAM = &BEAM_ADDRESS[0];
+  if (!_port[0].addr) {
+    _port[0].addr = BEAM_ADDRESS[0];
     Log.warn("%02x is not a valid Beam address (default to BEAMA %02x)", beamAddress, BEAM_ADDRESS[0]);
   }
 
   _gblMode = 0;
 }
 
+/*
+Member defaults shared by both constructors, before they set up the chain
+*/
+void Beam::init() {
+  _syncMode = SYNC_OFF;
+  _sync = NULL;
+  _shadow = NULL;
+  _updateMode = UPDATE_LIVE;
+  _frameDelay = 2;
+  _initialized = false;
+  _asyncMode = ASYNC_OFF;
+  _queue = NULL;
+  _queueHead = _queueTail = 0;
+  _executing = false;
+  _opPhase = 0;
+  _jobErrors = 0;
+  _workerBusy = false;
+  _workErrors = 0;
+  _doneCallback = NULL;
+  _pumpTimer = NULL;
+  _handoffMode = HANDOFF_POLL;
+  _handoffBusy = false;
+  _irqPending = false;
+  _irqTimer = NULL;
+  _cache = NULL;
+  _streamText = NULL;
+  _opDepth = 0;
+  _statsText = NULL;
+  _buses = 1;
+  _canvas = NULL;
+  _animation = NULL;
+  _bank = BEAM_NO_BANK;
+  _bankNext = BEAM_NO_BANK;
+  _bankWaiting = 0;
+  _scrollText = NULL;
+  _scrollCanvas = NULL;
+  _scrollDropped = 0;
+  _pwm = NULL;
+  _gammaLut = NULL;
+  memset(_frameSet, 0x00, sizeof(_frameSet));
+  _muxAddress = 0;
+  _muxChannel = BEAM_NO_CHANNEL;
+  _clockMode = CLOCK_KEEP;
+  _adaptiveClock = false;
+  memset(_clock, 0x00, sizeof(_clock));
+  _readTimeout = BEAM_READ_TIMEOUT;
+  _retries = BEAM_RETRIES;
+  _backoff = BEAM_BACKOFF;
+  _offlineAfter = BEAM_OFFLINE_AFTER;
+  memset(_failures, 0x00, sizeof(_failures));
+  memset(_offline, 0x00, sizeof(_offline));
+  memset(_stale, 0x00, sizeof(_stale));
+#if PLATFORM_THREADING
+  _worker = NULL;
+  _workerQuit = false;
+#endif
+  clearStats();
+  memset(_frameQueued, 0x00, sizeof(_frameQueued));
+  memset(_regsel, 0x00, sizeof(_regsel));
+}
+
+Beam::~Beam() {
+  if (_sync) _sync->remove(*this);
+#if PLATFORM_THREADING
+  if (_worker) {
+    _workerQuit = true;
+    os_semaphore_give(_workStart, false);
+    os_semaphore_take(_workDone, CONCURRENT_WAIT_FOREVER, false);
+    delete _worker;
+    os_semaphore_destroy(_workStart);
+    os_semaphore_destroy(_workDone);
+  }
+#endif
+  if (_irqTimer) detachInterrupt(_irq);
+  delete _irqTimer;
+  delete _cache;
+  delete _pumpTimer;
+  free(_streamText);
+  free(_scrollText);
+  delete _scrollCanvas;
+  delete[] _statsText;
+  delete[] _queue;
+  delete[] _shadow;
+  delete[] _pwm;
+  delete[] _gammaLut;
+}
+
 bool Beam::begin(TwoWire& wire) {
-  Log.trace("bool Beam::begin(TwoWire& wire)");
-  _wire = &wire;
+  BEAM_TRACE_CALL("bool Beam::begin(TwoWire& wire)");
+  BeamOpTimer timer(*this, JOB_INIT);
+  if (_beamCount > BEAM_PER_BUS) {
+    Log.warn("%d Beams need a mux, see begin(wire, muxAddress) (default to %d)", _beamCount, BEAM_PER_BUS);
+    activeBeams = 
+    _beamCount = BEAM_PER_BUS;
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    _port[b].wire = &wire;
+    _port[b].bus = 0;
+    _port[b].channel = BEAM_NO_CHANNEL;
+  }
+  _buses = 1;
+  _muxAddress = 0;
 
-  //resets beam - will clear all beams
-  pinMode(_rst, OUTPUT);
-  digitalWrite(_rst, LOW);
-  delay(100);
-  digitalWrite(_rst, HIGH);
-  delay(250);
+  return startBus();
+}
+
+/*
+Like begin(wire), running the bus at the given clock. With adaptive the
+clock steps down while transactions keep failing (e.g. on long cables) and
+back up towards clock after a clean interval.
+*/
+bool Beam::begin(TwoWire& wire, BEAM_CLOCK clock, bool adaptive) {
+  BEAM_TRACE_CALL("bool Beam::begin(TwoWire& wire, BEAM_CLOCK clock, bool adaptive)");
+  _clockMode = clock;
+  _adaptiveClock = adaptive;
+  return begin(wire);
+}
+
+/*
+Spreads the chain over two buses: the first beamsOnWire beams sit on wire,
+the rest on wire1, each bus with its own set of addresses starting at
+BEAMA. Frame uploads then run on both buses at the same time, CTRL writes
+keep their order across the whole chain so CLKSYNC and the chain start
+behave as on a single bus. There is no mux on either bus.
+*/
+bool Beam::begin(TwoWire& wire, TwoWire& wire1, uint8_t beamsOnWire) {
+  BEAM_TRACE_CALL("bool Beam::begin(TwoWire& wire, TwoWire& wire1, uint8_t beamsOnWire)");
+  if (beamsOnWire < 1 || _beamCount <= beamsOnWire || &wire == &wire1) {
+    return begin(wire);
+  }
+
+  BeamOpTimer timer(*this, JOB_INIT);
+  if (beamsOnWire > BEAM_PER_BUS) beamsOnWire = BEAM_PER_BUS;
+  if (_beamCount > beamsOnWire + BEAM_PER_BUS) {
+    Log.warn("%d Beams need a mux, see begin(wire, muxAddress) (default to %d)", _beamCount, beamsOnWire + BEAM_PER_BUS);
+    activeBeams = 
+    _beamCount = beamsOnWire + BEAM_PER_BUS;
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    bool second = (b >= beamsOnWire);
+    _port[b].wire = second ? &wire1 : &wire;
+    _port[b].bus = second ? 1 : 0;
+    _port[b].channel = BEAM_NO_CHANNEL;
+    _port[b].addr = BEAM_ADDRESS[second ? b - beamsOnWire : b];
+  }
+  _buses = 2;
+  _muxAddress = 0;
+
+#if PLATFORM_THREADING
+  if (!_worker) {
+    os_semaphore_create(&_workStart, 1, 0);
+    os_semaphore_create(&_workDone, 1, 0);
+    _worker = new (std::nothrow) Thread("beam", [this]() { workerLoop(); });
+    if (!_worker) Log.warn("Not enough memory for bus worker (uploading one bus at a time)");
+  }
+#endif
+
+  return startBus();
+}
+
+/*
+Chains more beams than there are addresses by way of a TCA9548A mux at
+muxAddress: beam b sits on channel b / beamsPerChannel with the address
+BEAM_ADDRESS[b % beamsPerChannel]. Transfers are issued beam by beam, so
+the mux only switches when the next beam sits on another channel.
+*/
+bool Beam::begin(TwoWire& wire, uint8_t muxAddress, uint8_t beamsPerChannel) {
+  BEAM_TRACE_CALL("bool Beam::begin(TwoWire& wire, uint8_t muxAddress, uint8_t beamsPerChannel)");
+  if (beamsPerChannel < 1 || BEAM_PER_BUS < beamsPerChannel) {
+    Log.warn("Beams per mux channel must be between 1 and %d and not %d (default to %d)", BEAM_PER_BUS, beamsPerChannel, BEAM_PER_BUS);
+    beamsPerChannel = BEAM_PER_BUS;
+  }
+
+  BeamOpTimer timer(*this, JOB_INIT);
+  if (_beamCount > beamsPerChannel * BEAM_MUX_CHANNELS) {
+    Log.warn("%d Beams don't fit on %d mux channels of %d Beams (default to %d)", _beamCount, BEAM_MUX_CHANNELS, beamsPerChannel, beamsPerChannel * BEAM_MUX_CHANNELS);
+    activeBeams = 
+    _beamCount = beamsPerChannel * BEAM_MUX_CHANNELS;
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    _port[b].wire = &wire;
+    _port[b].bus = 0;
+    _port[b].channel = b / beamsPerChannel;
+    _port[b].addr = BEAM_ADDRESS[b % beamsPerChannel];
+  }
+  _buses = 1;
+  _muxAddress = muxAddress;
+  _muxChannel = BEAM_NO_CHANNEL;
 
-  //reset cs[]
-  memset((uint8_t*)cs, 0x00, sizeof(cs));
+  return startBus();
+}
 
-  //reset segmentmask[]
-  for (int s = 0; s < 8; s++) {
-    segmentmask[s] = 0x0001 << (7 - s);
+/*
+Common end of the begin() overloads once the bus layout of the chain is
+set: allocates the register shadow, sets the bus clock and resets the
+beams
+*/
+bool Beam::startBus() {
+  if (!_shadow) {
+    // zeroed like the chips after the reset, recoverBeam() replays all of it
+    _shadow = new (std::nothrow) BeamShadow[_beamCount]();
+    if (!_shadow) Log.warn("Not enough memory for register shadow (writing through)");
   }
+  applyClock();
+
+  //resets beam - will clear all beams
+  resetBeams();
 
   return true;
 }
 
 void Beam::initBeam() {
-  Log.trace("void Beam::initBeam()");
+  BEAM_TRACE_CALL("void Beam::initBeam()");
+  BeamOpTimer timer(*this, JOB_INIT);
   //initialize Beam 
   for (unsigned int b = 0; b < _beamCount; b++) {
-    Log.trace("clearing BEAM[%d]", b);
-    initializeBeam(BEAM[b]);
+    BEAM_TRACE_CALL("clearing BEAM[%d]", b);
+    initializeBeam(b);
   }
+  _initialized = true;
+  finishJob(JOB_INIT);
 }
 
 void Beam::print(const char* text) {
-  Log.trace("void Beam::print(const char* text)");
-  //resets beam - will clear all beams
-  pinMode(_rst, OUTPUT);
-  digitalWrite(_rst, LOW);
-  delay(100);
-  digitalWrite(_rst, HIGH);
-  delay(250);
-
+  BEAM_TRACE_CALL("void Beam::print(const char* text)");
+  BeamOpTimer timer(*this, JOB_PRINT);
   Log.info("Text to print: %s", text);
 
-  initBeam();
+  if (_cache) {
+    print(*_cache->render(text));
+    return;
+  }
 
-  // Clear all frames
-  memset((uint8_t*)cs, 0x00, sizeof(cs));
+  BeamImage image;
+  beamRender(text, image);
+  print(image);
+}
 
-  for (int i = 0; i < 36; i++) {
-    for (unsigned int b = 0; b < _beamCount; b++) {
-      writeFrame(BEAM[b], i);
+/*
+Uploads text rendered by beamRender() and sets the chain up to scroll it.
+The same image serves every beam, each one gets it shifted by its position
+in the chain.
+*/
+void Beam::print(const BeamImage &image) {
+  BEAM_TRACE_CALL("void Beam::print(const BeamImage &image)");
+  BeamOpTimer timer(*this, JOB_PRINT);
+  stopPlayback();
+  prepareUpdate();
+
+  // frames taken by the text are written first and only the remaining ones
+  // are cleared afterwards, so no frame gets written twice
+  uint64_t textFrames[MAXBEAMS] = { 0 };
+
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    for (int frame = 0; frame < image.frames; frame++) {
+      uint8_t f = frame + (_beamCount - b);
+      if (f >= MAXFRAME) break;
+      writeFrame(b, f, image.cs[frame]);
+      textFrames[b] |= 1ULL << f;
     }
   }
+  if (image.frames) {
+    _lastFrameWrite = image.frames - 1 + _beamCount;
+  }
 
-  int i = 0;
-  const uint8_t *fontptr;
-  int frame = 0;
+  clearOtherFrames(textFrames);
+
+  //defaults Beam to basic settings
+  setPrintDefaults(SCROLL, 0, 6, 7, 5, 1, 0);
+  finishJob(JOB_PRINT);
+}
 
-  int asciiVal;
-  int cscount = 0;
-  int stringLen = strlen(text);
+void Beam::printFrame(uint8_t frameToPrint, const char * text) {
+  BEAM_TRACE_CALL("void Beam::printFrame(uint8_t frameToPrint, const char * text)");
+  BeamOpTimer timer(*this, JOB_PRINT);
+  Log.info("Text to print: %s", text);
+
+  stopPlayback();
+  _canvas = NULL;
+
+  BeamImage image;
+  beamRender(text, image);
 
-  while ((i < stringLen) && frame < 36) {
-    // pick a character to print to Beam
-    asciiVal = toupper(text[i]);
-    if (32 <= asciiVal && asciiVal <= 96) {
-      fontptr = &charactermap[(asciiVal - 32)][0];   //set fontptr to matching font
+  // only completely filled frames are printed
+  int frame = frameToPrint;
+  for (int i = 0; i < image.fullFrames && frame < MAXFRAME; i++) {
+    for (unsigned int b = 0; b < _beamCount; b++) {
+      writeFrame(b, frame, image.cs[i]);
     }
-    else {
-      switch (text[i]) {
-        case 0xC3: // two byte character prefix to be ignored
-          i++;
-          continue;
-          break;
-        case 0x84: // (0xC3 0x84) 'Ä'
-        case 0xA4: // (0xC3 0xA4) 'ä'
-          fontptr = &charactermap[65][0];
-          break;
-        case 0x96: // (0xC3 0x96) 'Ö'
-        case 0xB6: // (0xC3 0x86) 'ö'
-          fontptr = &charactermap[66][0];
-          break;
-        case 0x9C: // (0xC3 0x9C) 'Ü'
-        case 0xBC: // (0xC3 0xBC) 'ü'
-          fontptr = &charactermap[67][0];
-          break;
-        case 0x9F: // (0xC3 0xDF) 'ß'
-          fontptr = &charactermap[68][0];
-          break;
-        default:
-          fontptr = &charactermap[0][0];
-          break;
-      }
+
+    frame++;            // go to next frame
+    _lastFrameWrite = frame;
+
+    // if a specific frame is specified, then return if that frame is done.
+    if (frameToPrint != 0 && frame > frameToPrint) {
+      //defaults Beam to basic settings
+      setPrintDefaults(SCROLL, 0, _lastFrameWrite, 7, 15, 1, 1);
+      break;
     }
+  }
+  finishJob(JOB_PRINT);
+}
 
-    // loop through the Beam grid and place characters
-    // from the character map
-    Log.trace("%c = %d (0x%02x)\r\ncscolumn[] = ", text[i], asciiVal, asciiVal);
-    while (cscount < 24 && *fontptr != 0xFF) {
-      cscolumn[cscount] = *fontptr;
-      Log.trace("0x%02x", cscolumn[cscount]);
-      fontptr++;
-      cscount++;
-    }
-    i++;  // go to next character
-
-    if (cscount > 23) {
-      // if end of grid is reached in current frame,
-      // then start writing to the Beam registers
-      Log.trace("--- end of frame reached ---\r\nwriting cs[]");
-      for (int j = 0; j < 12; j++) {
-        cs[j] = (cscolumn[j * 2]) | (cscolumn[j * 2 + 1] << 5);
-        Log.trace("0x%02x", cs[j]);
-      }
-      Log.trace("--- end of cs[] ---");
+/*
+Scrolls text of any length. The 36 frames of each chip are used as a ring:
+updateStream(), called regularly from loop(), follows the frame on display
+and refills the frames just played with the next part of the text while the
+chip keeps scrolling. The text repeats until print(), draw() or stopStream().
+*/
+void Beam::printStream(const char* text) {
+  BEAM_TRACE_CALL("void Beam::printStream(const char* text)");
+  BeamOpTimer timer(*this, JOB_PRINT);
+  Log.info("Text to stream: %s", text);
+  stopPlayback();
+  prepareUpdate();
+
+  _streamText = strdup(text);
+  if (!_streamText) {
+    Log.warn("Not enough memory to stream text");
+    return;
+  }
+  _streamRenderer = BeamRenderer(_streamText);
+  _streamTail = 0;
+  _streamNext = 0;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    _streamFill[b] = 0;
+    _streamPos[b] = 0;
+    _streamCursor[b] = 0;
+  }
 
-      for (unsigned int b = 0; b < _beamCount; b++) {
-        writeFrame(BEAM[b], frame + (_beamCount - b));
-      }
-      _lastFrameWrite = frame + _beamCount;
+  fillStream();
 
-      for (int x = 0; x < 12; x++) {
-        cs[x] = 0x00;
-        cscolumn[x * 2] = 0x00;
-        cscolumn[x * 2 + 1] = 0x00;
-      }
-      frame++;            // go to next frame
-      cscount = 0;        // reset cscount
-
-      // if a specific frame is specified, then return if that frame is done.
-      //ADD THIS LATER
-      //if (frameNum!=0 && frame > frameNum){
-      //    return;
-      //}
-
-      if (*fontptr != 0xFF) {
-        //special case if current character needs to wrap to next frame
-        Log.trace("Continuing prev char cscolumn[] = ");
-
-        while (cscount < 24 && *fontptr != 0xFF) {
-          cscolumn[cscount] = *fontptr;
-          Log.trace("0x%02x", cscolumn[cscount]);
-          fontptr++;
-          cscount++;
-        }
-      }
+  uint64_t textFrames[MAXBEAMS] = { 0 };
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    for (uint32_t k = 0; k < _streamFill[b]; k++) {
+      textFrames[b] |= 1ULL << ((k + _beamCount - b) % MAXFRAME);
     }
+  }
+  clearOtherFrames(textFrames);
 
-    if (stringLen == i) {
-      // if end of string is reached in current frame,
-      // then start writing to Beam registers
-      Log.trace("--- end of string reached ---\r\nwriting cs[]");
-      for (int j = 0; j < 12; j++) {
-        cs[j] = (cscolumn[j * 2]) | (cscolumn[j * 2 + 1] << 5);
-        Log.trace("0x%02x", cs[j]);
-      }
-      Log.trace("--- done cs print ---");
+  // loop over the whole ring
+  _lastFrameWrite = MAXFRAME - 1;
+  setPrintDefaults(SCROLL, 0, MAXFRAME, 7, 5, 1, 0);
+  _streamPoll = millis();
+  finishJob(JOB_PRINT);
+}
 
-      for (unsigned int b = 0; b < _beamCount; b++) {
-        writeFrame(BEAM[b], frame + (_beamCount - b));
-      }
-      _lastFrameWrite = frame + _beamCount;
+/*
+Keeps a streamed text going, returns false when nothing is streaming
+*/
+bool Beam::updateStream() {
+  if (!_streamText) return false;
+  if (millis() - _streamPoll < 20) return true;
+  _streamPoll = millis();
 
-      for (int x = 0; x < 12; x++) {
-        cs[x] = 0x00;
-        cscolumn[x * 2] = 0x00;
-        cscolumn[x * 2 + 1] = 0x00;
-      }
-    }
+  int online = -1;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (_offline[b]) continue;
+    uint8_t cursor = (sendReadCmd(b, CTRL, STATUS) >> 2) % MAXFRAME;
+    _streamPos[b] += (cursor + MAXFRAME - _streamCursor[b]) % MAXFRAME;
+    _streamCursor[b] = cursor;
+    if (online < 0) online = b;
+  }
+  // offline beams follow along in the shadow, so they are up to date when
+  // they come back
+  for (unsigned int b = 0; b < _beamCount && online >= 0; b++) {
+    if (!_offline[b]) continue;
+    _streamPos[b] = _streamPos[online];
+    _streamCursor[b] = _streamCursor[online];
   }
 
-  //defaults Beam to basic settings
-  setPrintDefaults(SCROLL, 0, 6, 7, 5, 1, 0);
+  fillStream();
+  if (_asyncMode == ASYNC_OFF || !_queue) flushQueuedFrames();
+  return true;
 }
 
-void Beam::printFrame(uint8_t frameToPrint, const char * text) {
-  Log.trace("void Beam::printFrame(uint8_t frameToPrint, const char * text)");
-  Log.info("Text to print: %s", text);
+void Beam::stopStream() {
+  free(_streamText);
+  _streamText = NULL;
+}
 
-  int i = 0;
-  const uint8_t * fontptr;
-  int frame = frameToPrint;
+/*
+Plays animation frame by frame, each for its own time, on picture frames
+0 and 1. updateAnimation(), called regularly from loop(), decodes the next
+frame when it is due into the picture frame not on display and switches
+over to it, so only the CS registers that changed go on the bus. A chain
+wider than the animation repeats it. animation has to stay around until
+it ended or stopAnimation() got called.
+*/
+void Beam::playAnimation(BeamAnimation &animation) {
+  BEAM_TRACE_CALL("void Beam::playAnimation(BeamAnimation &animation)");
+  BeamOpTimer timer(*this, JOB_DRAW);
+  stopPlayback();
+  prepareUpdate();
 
-  int asciiVal;
-  int cscount = 0;
-  int stringLen = strlen(text);
+  _animation = &animation;
+  _animationFrame = 1;
+  _animationDue = millis();
 
-  while ((i < stringLen) && frame < 36) {
-    // pick a character to print to Beam
-    asciiVal = toupper(text[i]);
-    if (32 <= asciiVal && asciiVal <= 96) {
-      fontptr = &charactermap[(asciiVal - 32)][0];   //set fontptr to matching font
-    }
-    else {
-      switch (text[i]) {
-        case 0xC3: // two byte character prefix to be ignored
-          i++;
-          continue;
-          break;
-        case 0x84: // (0xC3 0x84) 'Ä'
-        case 0xA4: // (0xC3 0xA4) 'ä'
-          fontptr = &charactermap[65][0];
-          break;
-        case 0x96: // (0xC3 0x96) 'Ö'
-        case 0xB6: // (0xC3 0x86) 'ö'
-          fontptr = &charactermap[66][0];
-          break;
-        case 0x9C: // (0xC3 0x9C) 'Ü'
-        case 0xBC: // (0xC3 0xBC) 'ü'
-          fontptr = &charactermap[67][0];
-          break;
-        case 0x9F: // (0xC3 0xDF) 'ß'
-          fontptr = &charactermap[68][0];
-          break;
-        default:
-          fontptr = &charactermap[0][0];
-          break;
-      }
+  uint8_t displayData = 0 << 7 | 0 << 6 | 0 << 5 | 0 << 4 | 0x0B;
+  uint8_t currsrcData = displayCurrent();
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, MOV, 0x00);
+    writeCtrl(b, CURSRC, currsrcData);
+    writeCtrl(b, DISPLAYO, displayData);
+  }
+
+  updateAnimation();
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, SHDN, 0x03);
+  }
+  finishJob(JOB_DRAW);
+}
+
+/*
+Shows the next frame of the animation once it is due, returns false when
+no animation is playing (any more)
+*/
+bool Beam::updateAnimation() {
+  if (!_animation) return false;
+  if ((int32_t)(millis() - _animationDue) < 0) return true;
+
+  int time = _animation->nextFrame();
+  if (time == 0) return true;             // stream has no more bytes yet
+  if (time < 0) {
+    if (_animation->loop() && _animation->rewind()) return true;
+    _animation = NULL;
+    return false;
+  }
+
+  uint8_t next = _animationFrame ^ 1;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    uint16_t words[12];
+    beamPackColumns(_animation->columns() + (b % _animation->width()) * BEAM_COLUMNS, words);
+    writeFrame(b, next, words);
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, PIC, 0 << 7 | 1 << 6 | next);
+  }
+  _animationFrame = next;
+
+  // keeps the pace, but does not rush to catch up after a long stall
+  _animationDue += time;
+  if ((int32_t)(millis() - _animationDue) > time) _animationDue = millis() + time;
+  return true;
+}
+
+void Beam::stopAnimation() {
+  _animation = NULL;
+}
+
+/*
+Double buffered movies. The frame RAM is split into bank A (frames 0 to
+17) and bank B (18 to 35): the first loadBank() uploads bank A and loops
+it, every further one uploads the other bank while the chips keep playing
+and has each beam switch over at the end of the frame that closes its
+loop, see updateBanks(). columns holds frames of 24 * width column bytes
+each, like beamEncodeAnimation() takes them; a chain wider than width
+repeats them. Returns false while the bank loaded before still waits for
+its switch.
+*/
+bool Beam::loadBank(const uint8_t *columns, uint8_t frames, uint8_t width) {
+  BEAM_TRACE_CALL("bool Beam::loadBank(const uint8_t *columns, uint8_t frames, uint8_t width)");
+  if (frames < 1 || BEAM_BANK_FRAMES < frames || width < 1) {
+    Log.warn("A bank holds 1 to %d frames", BEAM_BANK_FRAMES);
+    return false;
+  }
+  if (_bankNext != BEAM_NO_BANK) return false;
+
+  BeamOpTimer timer(*this, JOB_DRAW);
+  bool start = (_bank == BEAM_NO_BANK);
+  if (start) {
+    stopPlayback();
+    prepareUpdate();
+  }
+
+  uint8_t bank = start ? 0 : _bank ^ 1;
+  uint8_t first = bank * BEAM_BANK_FRAMES;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    for (int f = 0; f < frames; f++) {
+      uint16_t words[12];
+      beamPackColumns(columns + (f * width + b % width) * BEAM_COLUMNS, words);
+      writeFrame(b, first + f, words);
     }
+  }
+  _bankFrames[bank] = frames;
+
+  if (!start) {
+    // the switch must not overtake the upload in the queue
+    _bankNext = bank;
+    submit(OP_BANK, 0, bank);
+    finishJob(JOB_DRAW);
+    return true;
+  }
+
+  _bank = bank;
+  _beamMode = MOVIE;
+  _scrollMode = 0;
+  uint8_t last = first + frames - 1;
+  uint8_t frameData = 0 << 7 | 0 << 6 | 0 << 5 | 0 << 4 | _frameDelay;
+  uint8_t displayData = 7 << 5 | 0 << 4 | 0x0B;
+  uint8_t currsrcData = displayCurrent();
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, MOVMODE, last);
+    writeCtrl(b, MOV, 0 << 7 | 1 << 6 | first);
+    writeCtrl(b, FRAMETIME, frameData);
+    writeCtrl(b, DISPLAYO, displayData);
+    writeCtrl(b, CURSRC, currsrcData);
+    writeCtrl(b, IRQFRAME, last);
+    writeCtrl(b, IRQMASK, 0x00);
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, SHDN, 0x03);
+  }
+  finishJob(JOB_DRAW);
+  return true;
+}
 
-    Log.trace("%c = %d (0x%02x)\r\ncscolumn[] = ", text[i], asciiVal, asciiVal);
-    // loop through the Beam grid and place characters
-    // from the character map
-    while (cscount < 24 && *fontptr != 0xFF) {
-      cscolumn[cscount] = *fontptr;
-      Log.trace("0x%02x", cscolumn[cscount]);
-      fontptr++;
-      cscount++;
+/*
+Switches every beam that shows the last frame of its bank to the bank
+loaded next. With HANDOFF_IRQ the beams interrupt at that frame and the
+switch happens without this; the status is still polled, although only
+every 100ms, should the IRQ line not be wired up. Returns false when bank
+mode is off.
+*/
+bool Beam::updateBanks() {
+  if (_bank == BEAM_NO_BANK) return false;
+  if (_handoffMode == HANDOFF_IRQ && _irqPending) handleIrq();
+
+  uint32_t interval = (_handoffMode == HANDOFF_IRQ) ? 100 : 10;
+  if (!_bankWaiting || millis() - _bankPoll < interval) return true;
+  _bankPoll = millis();
+
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  uint8_t last = _bank * BEAM_BANK_FRAMES + _bankFrames[_bank] - 1;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (!(_bankWaiting & (1 << b))) continue;
+    // offline beams switch in the shadow, recoverBeam() brings them along
+    if (_offline[b] || (sendReadCmd(b, CTRL, STATUS) >> 2) == last) switchBank(b);
+  }
+  return true;
+}
+
+void Beam::stopBanks() {
+  _bank = BEAM_NO_BANK;
+  _bankNext = BEAM_NO_BANK;
+  _bankWaiting = 0;
+}
+
+/*
+Moves text across the whole chain one column at a time, fps steps a
+second, driven by updateScroll() from loop(). Every step is drawn into
+the picture frame not on display and then switched to, so only the CS
+registers that changed go on the bus and beams whose columns stayed the
+same are left alone. Steps the bus (or loop()) could not keep up with are
+skipped, so the text keeps its speed, and counted by droppedSteps().
+*/
+void Beam::scrollText(const char *text, uint8_t fps, bool loop) {
+  BEAM_TRACE_CALL("void Beam::scrollText(const char *text, uint8_t fps, bool loop)");
+  BeamOpTimer timer(*this, JOB_PRINT);
+  Log.info("Text to scroll: %s", text);
+  if (fps < 1 || 100 < fps) {
+    Log.warn("Enter a frame rate between 1 and 100");
+    return;
+  }
+  stopPlayback();
+  prepareUpdate();
+
+  if (!_scrollCanvas) _scrollCanvas = new (std::nothrow) BeamCanvas(_beamCount);
+  _scrollText = strdup(text);
+  if (!_scrollText || !_scrollCanvas || !_scrollCanvas->beams()) {
+    Log.warn("Not enough memory to scroll text");
+    stopScroll();
+    return;
+  }
+  _scrollCanvas->clear();
+  _scrollCanvas->flip();
+  _scrollPos = 0;
+  _scrollGlyph = NULL;
+  _scrollTail = 0;
+  _scrollLoop = loop;
+  _scrollFrames = 0;
+  _scrollPeriod = 1000000UL / fps;
+  _scrollDue = micros();
+  _scrollDropped = 0;
+
+  uint16_t blank[12] = { 0 };
+  uint8_t pictureData = 0 << 7 | 1 << 6 | 0;
+  uint8_t displayData = 0 << 7 | 0 << 6 | 0 << 5 | 0 << 4 | 0x0B;
+  uint8_t currsrcData = displayCurrent();
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeFrame(b, 0, blank);
+    writeCtrl(b, MOV, 0x00);
+    writeCtrl(b, PIC, pictureData);
+    writeCtrl(b, CURSRC, currsrcData);
+    writeCtrl(b, DISPLAYO, displayData);
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, SHDN, 0x03);
+  }
+  finishJob(JOB_PRINT);
+}
+
+/*
+Moves the text on by the steps that are due, returns false when no text
+is scrolling (any more)
+*/
+bool Beam::updateScroll() {
+  if (!_scrollText) return false;
+  int32_t late = micros() - _scrollDue;
+  if (late < 0) return true;
+
+  uint32_t steps = 1 + late / _scrollPeriod;
+  _scrollDue += steps * _scrollPeriod;
+  _scrollDropped += steps - 1;
+
+  bool end = false;
+  uint16_t width = _scrollCanvas->width();
+  for (uint32_t i = 0; i < steps && !end; i++) {
+    uint8_t column = nextScrollColumn();
+    _scrollCanvas->scroll(1);
+    _scrollCanvas->blit(width - 1, 0, &column, 1);
+    if (_scrollTail >= width) {
+      // the text is all out, it enters again or the chain stays blank
+      end = !_scrollLoop;
+      _scrollPos = 0;
+      _scrollTail = 0;
     }
-    i++;  // go to next character
+  }
 
-    if (cscount > 23) {
-      // if end of grid is reached in current frame,
-      // then start writing to the Beam registers
+  // transfers of the last step still queued, this one would only add to them
+  if (!end && _asyncMode != ASYNC_OFF && pending()) {
+    _scrollDropped++;
+    return true;
+  }
 
-      Log.trace("--- end of frame reached ---\r\nwriting cs[]");
-      for (int j = 0; j < 12; j++) {
-        cs[j] = (cscolumn[j * 2]) | (cscolumn[j * 2 + 1] << 5);
-        Log.trace("0x%02x", cs[j]);
-      }
-      Log.trace("--- end of cs[] ---");
+  uint16_t changed = 0;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (!_scrollCanvas->changed(b)) continue;
+    changed |= 1 << b;
 
-      for (unsigned int b = 0; b < _beamCount; b++) {
-        writeFrame(BEAM[b], frame);
-        //_lastFrameWrite = frame;
-      }
+    uint16_t words[12];
+    beamPackColumns(_scrollCanvas->columns(b), words);
+    writeFrame(b, ((_scrollFrames >> b) & 1) ^ 1, words);
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (!(changed & (1 << b))) continue;
+    _scrollFrames ^= 1 << b;
+    writeCtrl(b, PIC, 0 << 7 | 1 << 6 | ((_scrollFrames >> b) & 1));
+  }
+  _scrollCanvas->flip();
 
-      for (int x = 0; x < 12; x++) {
-        cs[x] = 0x00;
-        cscolumn[x * 2] = 0x00;
-        cscolumn[x * 2 + 1] = 0x00;
-      }
+  if (end) stopScroll();
+  return !end;
+}
 
-      frame++;            // go to next frame
-      cscount = 0;        // reset cscount
-      _lastFrameWrite = frame;
+void Beam::stopScroll() {
+  free(_scrollText);
+  _scrollText = NULL;
+}
 
-      // if a specific frame is specified, then return if that frame is done.
-      if (frameToPrint != 0 && frame > frameToPrint) {
-        //defaults Beam to basic settings
-        setPrintDefaults(SCROLL, 0, _lastFrameWrite, 7, 15, 1, 1);
-        return;
-      }
+/*
+Steps scrollText() had to skip to keep the speed
+*/
+uint32_t Beam::droppedSteps() {
+  return _scrollDropped;
+}
+
+/*
+Next column of the scrolled text, blank ones once all of it moved in
+*/
+uint8_t Beam::nextScrollColumn() {
+  while (!_scrollGlyph || *_scrollGlyph == 0xFF) {
+    uint8_t c = _scrollText[_scrollPos];
+    if (!c) {
+      _scrollTail++;
+      return 0x00;
     }
+    _scrollPos++;
+    if (c == 0xC3) continue;    // two byte character prefix, see beamGlyph()
+    _scrollGlyph = beamGlyph(c);
   }
+  return *_scrollGlyph++;
 }
 
-void Beam::play() {
-  Log.trace("void Beam::play()");
-  //start playing beams depending on scroll direction
-  if (_scrollDir == LEFT) {
-    sendWriteCmd(BEAM[_beamCount - 1], CTRL, SHDN, 0x03);
+/*
+Ends whatever the host keeps playing, before other content takes over
+*/
+void Beam::stopPlayback() {
+  stopStream();
+  stopAnimation();
+  stopBanks();
+  stopScroll();
+
+  // a handoff still running from the IRQ timer must not start beams of
+  // the content that replaces it
+  if (_handoffBusy && handoffByTimer()) {
+    std::lock_guard<RecursiveMutex> lock(_lock);
+    _handoffBusy = false;
+    activeBeams = _beamCount;
   }
-  else {
-    sendWriteCmd(BEAM[0], CTRL, SHDN, 0x03);
+}
+
+/*
+Lets the beams switch to bank once its frames are on the chips. A stale
+IRQ_FRAME is cleared before the beams may interrupt for the switch.
+*/
+void Beam::armBank(uint8_t bank) {
+  if (bank != _bankNext) return;      // bank mode got stopped meanwhile
+
+  _bankWaiting = (uint16_t)((1UL << _beamCount) - 1);
+  _bankPoll = millis() - 100;
+  if (_handoffMode != HANDOFF_IRQ) return;
+
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (!_offline[b]) sendReadCmd(b, CTRL, IRQSTAT);
+    writeCtrl(b, IRQMASK, IRQ_FRAME);
+  }
+}
+
+/*
+Moves the movie of beam b over to the next bank. The chip picks it up when
+the frame on display is done, which is the last one of the old bank.
+*/
+void Beam::switchBank(uint8_t b) {
+  uint8_t first = _bankNext * BEAM_BANK_FRAMES;
+  uint8_t last = first + _bankFrames[_bankNext] - 1;
+  writeCtrl(b, MOVMODE, last);
+  writeCtrl(b, MOV, 0 << 7 | 1 << 6 | first);
+  writeCtrl(b, IRQFRAME, last);
+  writeCtrl(b, IRQMASK, 0x00);
+
+  _bankWaiting &= ~(1 << b);
+  if (!_bankWaiting) {
+    _bank = _bankNext;
+    _bankNext = BEAM_NO_BANK;
   }
+}
 
+void Beam::play() {
+  BEAM_TRACE_CALL("void Beam::play()");
+  BeamOpTimer timer(*this, JOB_PLAY);
   if (_beamCount > 1) {
-    while (checkStatus() != 1) {
-      delay(10);
+    std::lock_guard<RecursiveMutex> lock(_lock);
+    activeBeams = _beamCount;
+    _handoffBusy = true;
+
+    if (_handoffMode == HANDOFF_IRQ) {
+      // every beam but the last raises IRQ when the frame is done at which
+      // the next beam in the chain has to be started
+      for (unsigned int b = 1; b < _beamCount; b++) {
+        writeCtrl(b, IRQFRAME, handoffFrame(b));
+        writeCtrl(b, IRQMASK, IRQ_FRAME);
+      }
+      writeCtrl(0, IRQMASK, 0x00);
     }
   }
+
+  //start playing beams depending on scroll direction
+  startNextBeam();
+
+  // without a queue to wait in play() returns right away when the IRQ
+  // timer starts the beams (see onIrqTimer())
+  if (_beamCount > 1 && !handoffByTimer()) {
+    submit(OP_PLAY, 0);
+  }
+  finishJob(JOB_PLAY);
+}
+
+/*
+True if the IRQ timer alone hands over between the beams of the chain,
+as there is no queue for an OP_PLAY to wait in
+*/
+bool Beam::handoffByTimer() {
+  return _handoffMode == HANDOFF_IRQ && (_asyncMode == ASYNC_OFF || !_queue);
 }
 
 void Beam::startNextBeam() {
-  Log.trace("void Beam::startNextBeam()");
-  Log.trace("_scrollDir: %d, _beamCount: %d, beamNumber: %d", _scrollDir, _beamCount, beamNumber);
+  BEAM_TRACE_CALL("void Beam::startNextBeam()");
+  BEAM_TRACE_CALL("_scrollDir: %d, _beamCount: %d, beamNumber: %d", _scrollDir, _beamCount, beamNumber);
 
   // since the original logic didn't make much sense, I assumed similar behaviour to Beam::play() might make more sense
   // see https://github.com/hoverlabs/beam_particle/issues/4
   //start playing beams depending on scroll direction
   if (_scrollDir == LEFT) {
-    sendWriteCmd(BEAM[_beamCount - 1], CTRL, SHDN, 0x03);
+    writeCtrl(_beamCount - 1, SHDN, 0x03);
   }
   else {
-    sendWriteCmd(BEAM[0], CTRL, SHDN, 0x03);
+    writeCtrl(0, SHDN, 0x03);
   }
 }
 
 void Beam::setScroll(uint8_t direction, uint8_t fade) {
-  Log.trace("void Beam::setScroll(uint8_t direction, uint8_t fade)");
+  BEAM_TRACE_CALL("void Beam::setScroll(uint8_t direction, uint8_t fade)");
+  BeamOpTimer timer(*this, JOB_CONFIG);
   if (direction != RIGHT && direction != LEFT) {
     Log.warn("Select either LEFT or RIGHT for direction");
     return;
@@ -385,14 +936,16 @@ void Beam::setScroll(uint8_t direction, uint8_t fade) {
   uint8_t frameData = _fadeMode << 7 | _scrollDir << 6 | 0 << 5 | _scrollMode << 4 | _frameDelay;
 
   for (unsigned int b = 0; b < _beamCount; b++) {
-    sendWriteCmd(BEAM[b], CTRL, FRAMETIME, frameData);
+    writeCtrl(b, FRAMETIME, frameData);
   }
+  finishJob(JOB_CONFIG);
 }
 
 void Beam::setSpeed(uint8_t speed) {
-  Log.trace("void Beam::setSpeed(uint8_t speed)");
+  BEAM_TRACE_CALL("void Beam::setSpeed(uint8_t speed)");
+  BeamOpTimer timer(*this, JOB_CONFIG);
   if (speed < 1 || 15 < speed) {
-    Log.trace("Enter a speed between 1 and 15");
+    BEAM_TRACE_CALL("Enter a speed between 1 and 15");
     return;
   }
 
@@ -403,12 +956,14 @@ void Beam::setSpeed(uint8_t speed) {
   uint8_t frameData = _fadeMode << 7 | _scrollDir << 6 | 0 << 5 | _scrollMode << 4 | _frameDelay;
 
   for (unsigned int b = 0; b < _beamCount; b++) {
-    sendWriteCmd(BEAM[b], CTRL, FRAMETIME, frameData);
+    writeCtrl(b, FRAMETIME, frameData);
   }
+  finishJob(JOB_CONFIG);
 }
 
 void Beam::setLoops(uint8_t loops) {
-  Log.trace("void Beam::setLoops(uint8_t loops)");
+  BEAM_TRACE_CALL("void Beam::setLoops(uint8_t loops)");
+  BeamOpTimer timer(*this, JOB_CONFIG);
   if (loops < 1 || 7 < loops) {
     Log.warn("Enter a speed between 1 and 7");
     return;
@@ -418,12 +973,14 @@ void Beam::setLoops(uint8_t loops) {
   uint8_t displayData = _numLoops << 5 | 0 << 4 | 0x0B;
 
   for (unsigned int b = 0; b < _beamCount; b++) {
-    sendWriteCmd(BEAM[b], CTRL, DISPLAYO, displayData);
+    writeCtrl(b, DISPLAYO, displayData);
   }
+  finishJob(JOB_CONFIG);
 }
 
 void Beam::setMode(uint8_t mode) {
-  Log.trace("void Beam::setMode(uint8_t mode)");
+  BEAM_TRACE_CALL("void Beam::setMode(uint8_t mode)");
+  BeamOpTimer timer(*this, JOB_CONFIG);
   if (mode != MOVIE && mode != SCROLL) {
     Log.warn("Select either SCROLL or MOVIE for mode");
     return;
@@ -440,129 +997,762 @@ void Beam::setMode(uint8_t mode) {
   }
 
   for (unsigned int b = 0; b < _beamCount; b++) {
-    sendWriteCmd(BEAM[b], CTRL, FRAMETIME, frameData);
+    writeCtrl(b, FRAMETIME, frameData);
   }
+  finishJob(JOB_CONFIG);
 }
 
 /*
-Used by global mode to check when daisy chained Beams
-should be activated depending on the scroll direction.
+UPDATE_LIVE (default) keeps an initialized chain running and print()/draw()
+only upload what changed. The beams are reset only by begin(); a beam that
+missed a write or comes back online is not reset but gets its register
+shadow written anew, the rest of the chain keeps running.
+UPDATE_RESET resets and re-initializes all beams on every print()/draw().
 */
-int Beam::checkStatus() {
-  Log.trace("int Beam::checkStatus()");
-  if ((sendReadCmd(BEAM[activeBeams - 1], CTRL, 0x0F) >> 2) == (_beamCount - activeBeams + 1)) {
-    sendWriteCmd(BEAM[--activeBeams - 1], CTRL, SHDN, 0x03);
-    if (activeBeams <= 1) {
-      delay(10);
-      activeBeams = _beamCount;
-      return 1;
-    }
+void Beam::setUpdateMode(uint8_t mode) {
+  BEAM_TRACE_CALL("void Beam::setUpdateMode(uint8_t mode)");
+  if (mode != UPDATE_LIVE && mode != UPDATE_RESET) {
+    Log.warn("Select either UPDATE_LIVE or UPDATE_RESET for update mode");
+    return;
   }
-  
-  return 0;
+
+  _updateMode = mode;
 }
 
-void Beam::draw() {
-  Log.trace("void Beam::draw()");
-  //resets beam - will clear all beams
-  pinMode(_rst, OUTPUT);
-  digitalWrite(_rst, LOW);
-  delay(100);
-  digitalWrite(_rst, HIGH);
-  delay(250);
+/*
+Selects how bus traffic is executed.
+ASYNC_OFF (default) runs every transfer inside the calling method.
+ASYNC_PUMP queues the transfers and leaves them to pump(), which the
+application calls from loop() with a time budget.
+ASYNC_TIMER queues the transfers and drains them from a software timer
+firing every period ms.
+*/
+void Beam::setAsync(uint8_t mode, unsigned int period) {
+  BEAM_TRACE_CALL("void Beam::setAsync(uint8_t mode, unsigned int period)");
+  if (mode != ASYNC_OFF && mode != ASYNC_PUMP && mode != ASYNC_TIMER) {
+    Log.warn("Select either ASYNC_OFF, ASYNC_PUMP or ASYNC_TIMER for async mode");
+    return;
+  }
 
-  initBeam();
+  // finish whatever was queued under the old mode
+  pump();
+  if (_pumpTimer) _pumpTimer->stop();
 
-  for (int i = 0; i < 36; ++i) {
-    convertFrame(frameList[i]);
-    // altered original frame counting logic: see https://github.com/hoverlabs/beam_particle/issues/6
-    for (unsigned int b = 0; b < _beamCount; b++) {
-      writeFrame(BEAM[b], i + (_beamCount - 1 - b));
+  if (mode != ASYNC_OFF && !_queue) {
+    _queue = new (std::nothrow) BeamOp[BEAM_QUEUE_SIZE];
+    if (!_queue) {
+      Log.warn("Not enough memory for transfer queue (staying synchronous)");
+      return;
     }
-    _lastFrameWrite = i + _beamCount - 1;
-
-    // reset cs[]
-    memset((uint8_t*)cs, 0x00, sizeof(cs));
   }
+  _asyncMode = mode;
+
+  if (mode == ASYNC_TIMER) {
+    if (period < 1) period = 1;
+    // leave the timer thread some headroom in every period
+    _pumpBudget = period * 500;
+    if (!_pumpTimer) {
+      _pumpTimer = new Timer(period, &Beam::onPumpTimer, *this);
+    }
+    else {
+      _pumpTimer->changePeriod(period);
+    }
+    _pumpTimer->start();
+  }
+}
 
-  setPrintDefaults(MOVIE, 1, 20, 7, 2, 1, 0);
+/*
+Executes queued transfers until the queue is empty or budget us have passed
+(budget 0 drains the whole queue). Returns true when nothing is pending.
+*/
+bool Beam::pump(uint32_t budget) {
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  if (!_queue || _executing) return _queueHead == _queueTail;
+
+  probeOffline();
+
+  uint32_t start = micros();
+  while (_queueHead != _queueTail) {
+    if (_buses > 1 && _queue[_queueHead].type == OP_FRAME) {
+      // upload a frame per beam from the head of the queue, both buses at once
+      uint64_t batch[MAXBEAMS] = { 0 };
+      for (int n = 0; n < _beamCount && _queueHead != _queueTail && _queue[_queueHead].type == OP_FRAME; n++) {
+        const BeamOp &op = _queue[_queueHead];
+        batch[op.beam] |= 1ULL << op.reg;
+        _frameQueued[op.beam] &= ~(1ULL << op.reg);
+        _queueHead = (_queueHead + 1) % BEAM_QUEUE_SIZE;
+      }
+      _executing = true;
+      flushFrames(batch);
+      _executing = false;
+      if (budget && micros() - start >= budget) break;
+      continue;
+    }
+
+    _executing = true;
+    bool done = execute(_queue[_queueHead]);
+    _executing = false;
+
+    if (done) {
+      _queueHead = (_queueHead + 1) % BEAM_QUEUE_SIZE;
+    }
+    else if (!budget) {
+      delay(1);
+    }
+    if (budget && micros() - start >= budget) break;
+    if (!done && budget) break;
+  }
+  return _queueHead == _queueTail;
 }
 
-void Beam::display() {
-  uint8_t pictureData = 0 << 7 | 1 << 6 | _beamCount;
-  uint8_t displayData = 0 << 7 | 0 << 6 | 0 << 5 | 0 << 4 | 0x0B;
-  uint8_t currsrcData = 0;
+uint16_t Beam::pending() {
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  return (_queueTail + BEAM_QUEUE_SIZE - _queueHead) % BEAM_QUEUE_SIZE;
+}
+
+/*
+callback is called whenever all transfers of a public operation (see BEAM_JOB)
+have been executed, ok is false if any of them failed
+*/
+void Beam::onDone(BeamCallback callback) {
+  _doneCallback = callback;
+}
+
+/*
+Selects how play() finds out when to start the next beam of a chain.
+HANDOFF_POLL (default) reads the frame status of the running beam every 10ms.
+HANDOFF_IRQ lets the beams raise the IRQ pin at the handoff frame; the next
+beam is then started from a timer right after the interrupt (or from the
+engine if the bus is busy), so there is no status polling and the latency
+does not depend on a poll interval. Without async mode play() doesn't wait
+for the handoff then.
+*/
+void Beam::setHandoff(uint8_t mode) {
+  BEAM_TRACE_CALL("void Beam::setHandoff(uint8_t mode)");
+  if (mode != HANDOFF_POLL && mode != HANDOFF_IRQ) {
+    Log.warn("Select either HANDOFF_POLL or HANDOFF_IRQ for handoff");
+    return;
+  }
+  if (mode == HANDOFF_IRQ && _irq < 0) {
+    Log.warn("HANDOFF_IRQ needs a valid IRQ pin");
+    return;
+  }
+
+  if (mode == HANDOFF_IRQ && !_irqTimer) {
+    _irqTimer = new Timer(1, &Beam::onIrqTimer, *this, true);
+    pinMode(_irq, INPUT_PULLUP);
+    attachInterrupt(_irq, &Beam::onIrq, this, FALLING);
+  }
+  else if (mode == HANDOFF_POLL && _irqTimer) {
+    detachInterrupt(_irq);
+    delete _irqTimer;
+    _irqTimer = NULL;
+  }
+  _handoffMode = mode;
+}
+
+/*
+Keeps the rendered images of recently printed texts in up to bytes of RAM,
+so that print() of a repeated message skips the layout (0 turns the cache off).
+Since uploads only send what differs from the chips, re-printing the message
+that is already shown costs no frame transfers at all.
+*/
+void Beam::setRenderCache(size_t bytes) {
+  BEAM_TRACE_CALL("void Beam::setRenderCache(size_t bytes)");
+  delete _cache;
+  _cache = NULL;
+  if (!bytes) return;
+
+  _cache = new (std::nothrow) BeamRenderCache(bytes);
+  if (!_cache || !_cache->capacity()) {
+    Log.warn("%u bytes are not enough for a render cache", (unsigned)bytes);
+    delete _cache;
+    _cache = NULL;
+  }
+}
+
+/*
+Gives access to the hit/miss counters, NULL while the cache is off
+*/
+const BeamRenderCache *Beam::renderCache() {
+  return _cache;
+}
+
+/*
+Bus statistics of beam (index in the chain), NULL if there is no such beam
+*/
+const BeamBusStats *Beam::busStats(uint8_t beam) {
+  if (beam >= _beamCount) return NULL;
+  return &_busStats[beam];
+}
+
+/*
+Latency histogram of the public operations reporting job (see BEAM_JOB).
+In async mode the calls only queue their bus work, which is not included.
+*/
+const BeamLatency *Beam::latency(uint8_t job) {
+  if (job >= BEAM_JOBS) return NULL;
+  return &_latency[job];
+}
+
+/*
+Sets the clock of every bus of the chain, see begin(wire, clock, adaptive)
+*/
+void Beam::setBusClock(BEAM_CLOCK clock, bool adaptive) {
+  BEAM_TRACE_CALL("void Beam::setBusClock(BEAM_CLOCK clock, bool adaptive)");
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  flushQueuedFrames();
+  _clockMode = clock;
+  _adaptiveClock = adaptive;
+  applyClock();
+}
+
+/*
+Current clock of a bus in Hz, 0 when the library leaves it alone
+*/
+uint32_t Beam::busClock(uint8_t bus) {
+  if (bus >= _buses || _clockMode == CLOCK_KEEP) return 0;
+  return clockSteps[_clock[bus].level];
+}
+
+/*
+Bounds the time a missing or misbehaving beam can hold up the chain: reads
+give up after readTimeout ms, failed transactions are repeated retries
+times after a backoff (in us, doubling with every repeat), and after
+offlineAfter failures in a row the beam is taken offline. Offline beams are
+skipped on the bus and probed every BEAM_PROBE_INTERVAL ms; once found
+again they are restored from the register shadow.
+*/
+void Beam::setBusTimeouts(uint16_t readTimeout, uint8_t retries, uint16_t backoff, uint8_t offlineAfter) {
+  BEAM_TRACE_CALL("void Beam::setBusTimeouts(uint16_t readTimeout, uint8_t retries, uint16_t backoff, uint8_t offlineAfter)");
+  _readTimeout = readTimeout;
+  _retries = retries;
+  _backoff = backoff;
+  _offlineAfter = offlineAfter ? offlineAfter : 1;
+}
+
+bool Beam::isOnline(uint8_t beam) {
+  return beam < _beamCount && !_offline[beam];
+}
+
+void Beam::clearStats() {
+  memset(_busStats, 0x00, sizeof(_busStats));
+  memset(_latency, 0x00, sizeof(_latency));
+  if (_statsText) updateStatsText();
+}
+
+/*
+Publishes a JSON summary of the statistics as Particle.variable name:
+per beam transactions, bytes, NACKs, bus resets, read timeouts, and per
+job (BEAM_JOB order) call count and average/maximum duration in us.
+*/
+bool Beam::exportStats(const char *name) {
+  BEAM_TRACE_CALL("bool Beam::exportStats(const char *name)");
+  if (!_statsText) {
+    _statsText = new (std::nothrow) char[BEAM_STATS_TEXT];
+    if (!_statsText) {
+      Log.warn("Not enough memory to export statistics");
+      return false;
+    }
+  }
+  updateStatsText();
+  return Particle.variable(name, _statsText);
+}
+
+void Beam::updateStatsText() {
+  int len = snprintf(_statsText, BEAM_STATS_TEXT, "{\"bus\":[");
+  for (unsigned int b = 0; b < _beamCount && len < BEAM_STATS_TEXT; b++) {
+    const BeamBusStats &st = _busStats[b];
+    len += snprintf(_statsText + len, BEAM_STATS_TEXT - len, "%s[%lu,%lu,%lu,%lu,%lu]", b ? "," : "",
+                    (unsigned long)st.transactions, (unsigned long)st.bytes, (unsigned long)st.nacks,
+                    (unsigned long)st.busResets, (unsigned long)st.readTimeouts);
+  }
+  if (len < BEAM_STATS_TEXT) len += snprintf(_statsText + len, BEAM_STATS_TEXT - len, "],\"us\":[");
+  for (int j = 0; j < BEAM_JOBS && len < BEAM_STATS_TEXT; j++) {
+    const BeamLatency &lat = _latency[j];
+    len += snprintf(_statsText + len, BEAM_STATS_TEXT - len, "%s[%lu,%lu,%lu]", j ? "," : "",
+                    (unsigned long)lat.count, (unsigned long)(lat.count ? lat.totalMicros / lat.count : 0),
+                    (unsigned long)lat.maxMicros);
+  }
+  if (len < BEAM_STATS_TEXT) snprintf(_statsText + len, BEAM_STATS_TEXT - len, "]}");
+}
+
+void Beam::recordLatency(uint8_t job, uint32_t us) {
+  BeamLatency &lat = _latency[job];
+  lat.count++;
+  lat.totalMicros += us;
+  if (us > lat.maxMicros) lat.maxMicros = us;
+
+  int i = 0;
+  while (i < BEAM_LATENCY_BUCKETS - 1 && us >= (1000UL << i)) i++;
+  lat.bucket[i]++;
+
+  if (_statsText) updateStatsText();
+}
+
+/*
+Used by global mode to check when daisy chained Beams
+should be activated depending on the scroll direction.
+Returns 1 once the first beam of the chain has been started.
+*/
+int Beam::checkStatus() {
+  BEAM_TRACE_CALL("int Beam::checkStatus()");
+  // an offline beam can't be watched, the next one is started right away
+  if (_offline[activeBeams - 1]
+   || (sendReadCmd(activeBeams - 1, CTRL, STATUS) >> 2) >= handoffFrame(activeBeams - 1)) {
+    writeCtrl(--activeBeams - 1, SHDN, 0x03);
+    if (activeBeams <= 1) {
+      activeBeams = _beamCount;
+      return 1;
+    }
+  }
+  
+  return 0;
+}
 
-  // change led current based on number of connected beams
+/*
+LED current for pictures, lower the more beams share the supply
+*/
+uint8_t Beam::displayCurrent() {
   switch (_beamCount) {
     case 1:
-      currsrcData = 0x20;
-      break;
+      return 0x20;
     case 2:
       // unexpected value: see https://github.com/hoverlabs/beam_particle/issues/5
-      currsrcData = 0x15;
-      break;
+      return 0x15;
     case 3:
-      currsrcData = 0x10;
-      break;
-    case 4:
-      currsrcData = 0x08;
-      break;
+      return 0x10;
     default:
-      currsrcData = 0x00;
-      break;
+      // 4 and more
+      return 0x08;
+  }
+}
+
+/*
+Frame at which beam b starts its predecessor in the chain: its position
+from the end of the chain, but never past the last frame of the movie, or
+long chains would wait for a frame that never comes
+*/
+uint8_t Beam::handoffFrame(uint8_t b) {
+  uint8_t lastFrame = (_lastFrameWrite < MAXFRAME) ? _lastFrameWrite : MAXFRAME - 1;
+  uint8_t frame = _beamCount - b;
+  return (frame < lastFrame) ? frame : lastFrame;
+}
+
+void Beam::draw() {
+  BEAM_TRACE_CALL("void Beam::draw()");
+  BeamOpTimer timer(*this, JOB_DRAW);
+  stopPlayback();
+  prepareUpdate();
+
+  uint64_t drawnFrames[MAXBEAMS] = { 0 };
+
+  for (int i = 0; i < 36; ++i) {
+    // altered original frame counting logic: see https://github.com/hoverlabs/beam_particle/issues/6
+    for (unsigned int b = 0; b < _beamCount; b++) {
+      writeFrame(b, i + (_beamCount - 1 - b), drawFrames.cs[i]);
+      drawnFrames[b] |= 1ULL << (i + (_beamCount - 1 - b));
+    }
+    _lastFrameWrite = i + _beamCount - 1;
+  }
+
+  clearOtherFrames(drawnFrames);
+
+  setPrintDefaults(MOVIE, 1, 20, 7, 2, 1, 0);
+  finishJob(JOB_DRAW);
+}
+
+void Beam::display() {
+  BeamOpTimer timer(*this, JOB_DISPLAY);
+  uint8_t pictureData = 0 << 7 | 1 << 6 | _beamCount;
+  uint8_t displayData = 0 << 7 | 0 << 6 | 0 << 5 | 0 << 4 | 0x0B;
+  uint8_t currsrcData = displayCurrent();
+
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, PIC, pictureData);
+    writeCtrl(b, CURSRC, currsrcData);
+    writeCtrl(b, DISPLAYO, displayData);
   }
 
   for (unsigned int b = 0; b < _beamCount; b++) {
-    sendWriteCmd(BEAM[b], CTRL, PIC, pictureData);
-    sendWriteCmd(BEAM[b], CTRL, CURSRC, currsrcData);
-    sendWriteCmd(BEAM[b], CTRL, DISPLAYO, displayData);
+    writeCtrl(b, SHDN, 0x03);
+  }
+  finishJob(JOB_DISPLAY);
+}
+
+/*
+Shows canvas as picture frame 0 of every beam. Only beams whose columns
+changed since the last present() get packed into CS words, and the shadow
+sends just the CS registers that differ from the chip.
+*/
+void Beam::present(BeamCanvas &canvas) {
+  BEAM_TRACE_CALL("void Beam::present(BeamCanvas &canvas)");
+  BeamOpTimer timer(*this, JOB_DISPLAY);
+  stopPlayback();
+  if (!_initialized) {
+    initBeam();
+  }
+
+  // after other content the whole canvas has to go up again
+  bool all = (_canvas != &canvas);
+  for (unsigned int b = 0; b < _beamCount && b < canvas.beams(); b++) {
+    if (!all && !canvas.changed(b)) continue;
+
+    uint16_t words[12];
+    beamPackColumns(canvas.columns(b), words);
+    writeFrame(b, 0, words);
+  }
+  canvas.flip();
+  _canvas = &canvas;
+
+  uint8_t pictureData = 0 << 7 | 1 << 6 | 0;
+  uint8_t displayData = 0 << 7 | 0 << 6 | 0 << 5 | 0 << 4 | 0x0B;
+  uint8_t currsrcData = displayCurrent();
+
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, MOV, 0x00);
+    writeCtrl(b, PIC, pictureData);
+    writeCtrl(b, CURSRC, currsrcData);
+    writeCtrl(b, DISPLAYO, displayData);
+  }
+
+  // already running the canvas, no need to start it again
+  for (unsigned int b = 0; all && b < _beamCount; b++) {
+    writeCtrl(b, SHDN, 0x03);
+  }
+  finishJob(JOB_DISPLAY);
+}
+
+/*
+Gamma applied by setLevels() from then on, 1.0 passes levels through
+*/
+void Beam::setGamma(float gamma) {
+  BEAM_TRACE_CALL("void Beam::setGamma(float gamma)");
+  if (gamma <= 0.0f || gamma == 1.0f) {
+    delete[] _gammaLut;
+    _gammaLut = NULL;
+    return;
+  }
+
+  if (!_gammaLut) _gammaLut = new (std::nothrow) uint8_t[256];
+  if (!_gammaLut) {
+    Log.warn("Not enough memory for gamma table (linear levels)");
+    return;
+  }
+  for (int i = 0; i < 256; i++) {
+    _gammaLut[i] = (uint8_t)(powf(i / 255.0f, gamma) * 255.0f + 0.5f);
+  }
+}
+
+/*
+Sets the brightness of every LED in PWM set set from levels[y * width + x],
+one byte per pixel of the chain (width = 24 * beams, as BeamCanvas). LEDs
+show that brightness while a frame bound to set (see bindFrame()) has them
+on. Only PWM bytes that changed are sent.
+*/
+void Beam::setLevels(uint8_t set, const uint8_t *levels, uint16_t width) {
+  BEAM_TRACE_CALL("void Beam::setLevels(uint8_t set, const uint8_t *levels, uint16_t width)");
+  if (set >= BEAM_PWM_SETS) {
+    Log.warn("PWM set must be between 0 and %d and not %d", BEAM_PWM_SETS - 1, set);
+    return;
+  }
+
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  if (!_pwm) {
+    _pwm = new (std::nothrow) BeamPwm[_beamCount];
+    if (!_pwm) {
+      Log.warn("Not enough memory for grayscale");
+      return;
+    }
+    // what loadBlinkPwmSets() leaves on the chips
+    memset(_pwm, 0x00, _beamCount * sizeof(BeamPwm));
+    for (unsigned int b = 0; b < _beamCount; b++) {
+      memset(_pwm[b].level, 0xFF, sizeof(_pwm[b].level));
+    }
   }
 
+  for (unsigned int b = 0; b < _beamCount && (b + 1) * BEAM_COLUMNS <= width; b++) {
+    BeamPwm &pwm = _pwm[b];
+    for (int x = 0; x < BEAM_COLUMNS; x++) {
+      for (int y = 0; y < BEAM_ROWS; y++) {
+        uint8_t level = levels[y * width + b * BEAM_COLUMNS + x];
+        if (_gammaLut) level = _gammaLut[level];
+
+        int i = (x / 2) * 11 + (x % 2) * 5 + y;
+        if (pwm.level[set][i] == level) continue;
+        pwm.level[set][i] = level;
+        pwm.dirty[set][i / 32] |= 1UL << (i % 32);
+      }
+    }
+    pwm.custom |= 1 << set;
+
+    bool dirty = false;
+    for (int w = 0; w < 5; w++) dirty |= (pwm.dirty[set][w] != 0);
+    if (dirty && !(pwm.queued & (1 << set))) {
+      pwm.queued |= 1 << set;
+      submit(OP_PWM, b, set);
+    }
+  }
+}
+
+/*
+Makes frame take its LED brightness from PWM set set (bits 7:5 of the
+frame's first CS word). The binding sticks with the frame number for
+everything written to it later on.
+*/
+void Beam::bindFrame(uint8_t frame, uint8_t set) {
+  BEAM_TRACE_CALL("void Beam::bindFrame(uint8_t frame, uint8_t set)");
+  if (frame >= MAXFRAME || set >= BEAM_PWM_SETS) {
+    Log.warn("Frame must be between 0 and %d and PWM set between 0 and %d", MAXFRAME - 1, BEAM_PWM_SETS - 1);
+    return;
+  }
+  _frameSet[frame] = set;
+  if (!_shadow) return;
+
+  std::lock_guard<RecursiveMutex> lock(_lock);
   for (unsigned int b = 0; b < _beamCount; b++) {
-    sendWriteCmd(BEAM[b], CTRL, SHDN, 0x03);
+    uint8_t &data = _shadow[b].frame[frame][1];
+    if ((data >> 5) == set) continue;
+
+    data = (data & 0x03) | set << 5;
+    _shadow[b].frameDirty[frame] |= 1UL << 1;
+    if (!(_frameQueued[b] & (1ULL << frame))) {
+      _frameQueued[b] |= 1ULL << frame;
+      submit(OP_FRAME, b, frame);
+    }
   }
+  // frames on two buses wait for the next operation, there is none to come
+  if (_asyncMode == ASYNC_OFF || !_queue) flushQueuedFrames();
 }
 
 int Beam::status() {
   int frameDone = 0;
 
-  if (_gblMode == 0) {
-    frameDone = (sendReadCmd(BEAM[0], CTRL, 0x0F) >> 2);
-    Log.trace("Frame done (%d)", frameDone);
+  if (_gblMode == 0 || _beamCount == 1) {
+    frameDone = (sendReadCmd(0, CTRL, STATUS) >> 2);
+    BEAM_TRACE_CALL("Frame done (%d)", frameDone);
   }
   return frameDone;
 }
 
+uint8_t Beam::beamCount() {
+  return _beamCount;
+}
+
+/*
+Makes the beam a unit of sync, NULL takes it out again. False if it is a
+unit of another BeamSync already.
+*/
+bool Beam::setSync(BeamSync *sync) {
+  if (sync && _sync && _sync != sync) return false;
+  _sync = sync;
+  return true;
+}
+
+uint8_t Beam::syncMode() {
+  return _syncMode;
+}
+
+/*
+Puts the beams on the clock sync line as mode (BEAM_SYNC) says, right away
+instead of through the async queue
+*/
+void Beam::setSyncMode(uint8_t mode) {
+  BEAM_TRACE_CALL("void Beam::setSyncMode(uint8_t mode)");
+  if (mode > SYNC_SLAVE) {
+    Log.warn("Select SYNC_OFF, SYNC_MASTER or SYNC_SLAVE for the clock sync line");
+    return;
+  }
+
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  bool nested = _executing;
+  _executing = true;
+  applySyncMode(mode);
+  _executing = nested;
+}
+
+/*
+Frames of the movie the beams are set up with, a picture counts as a movie
+of one frame
+*/
+void Beam::movieFrames(uint8_t &first, uint8_t &length) {
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  first = 0;
+  length = 1;
+  if (!_shadow) return;
+
+  const uint8_t *ctrl = _shadow[0].ctrl;
+  if (ctrl[MOV] & 0x40) {
+    uint8_t last = ctrl[MOVMODE] & 0x3F;
+    first = ctrl[MOV] & 0x3F;
+    length = (last >= first) ? last - first + 1 : 1;
+  }
+  else {
+    first = ctrl[PIC] & 0x3F;
+  }
+}
+
+/*
+Writes CTRL register reg of every beam right away instead of through the
+async queue, so units in step see it at the same time. Without wait it
+gives up and returns false when the bus is taken.
+*/
+bool Beam::writeCtrlNow(uint8_t reg, uint8_t data, bool wait) {
+  if (wait) _lock.lock();
+  else if (!_lock.trylock()) return false;
+
+  bool nested = _executing;
+  _executing = true;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, reg, data);
+  }
+  _executing = nested;
+  _lock.unlock();
+  return true;
+}
+
 /*
 =================
 PRIVATE FUNCTIONS
 =================
 */
 
-void Beam::initializeBeam(uint8_t baddr) {
-  Log.trace("void Beam::initializeBeam(uint8_t baddr)");
+/*
+Pulses the shared reset line, which clears all beams on the bus
+*/
+void Beam::resetBeams() {
+  BEAM_TRACE_CALL("void Beam::resetBeams()");
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  // whatever gets written from now on has to be sent after the reset
+  invalidateShadow();
+  memset(_frameQueued, 0x00, sizeof(_frameQueued));
+  _initialized = false;
+  _canvas = NULL;
+  memset(_stale, 0x00, sizeof(_stale));
+
+  submit(OP_RESET, 0);
+}
+
+/*
+Gets the chain ready for new content, resetting it only when required. A
+beam that missed a write gets its shadow replayed, the rest of the chain
+keeps what it shows.
+*/
+void Beam::prepareUpdate() {
+  _canvas = NULL;
+  if (_updateMode == UPDATE_RESET) {
+    //resets beam - will clear all beams
+    resetBeams();
+  }
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (_stale[b] && !_offline[b]) recoverBeam(b);
+  }
+
+  if (!_initialized) {
+    initBeam();
+  }
+}
+
+/*
+Uploads streamed text frames as far as the playback allows. Text frame k
+goes to ring position k + _beamCount - b of beam b (like print()), and may
+overwrite the frame that was played MAXFRAME positions earlier once that
+one and a frame of margin are done.
+*/
+void Beam::fillStream() {
+  // the ring of rendered frames must still hold what the slowest beam needs
+  uint32_t oldest = _streamNext;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (_streamFill[b] < oldest) oldest = _streamFill[b];
+  }
+
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    while (_streamFill[b] + _beamCount - b < _streamPos[b] + MAXFRAME - 1) {
+      uint32_t k = _streamFill[b];
+      if (k >= _streamNext) {
+        if (_streamNext - oldest >= BEAM_STREAM_RING) break;
+        nextStreamFrame(_streamRing[_streamNext % BEAM_STREAM_RING]);
+        _streamNext++;
+      }
+      writeFrame(b, (k + _beamCount - b) % MAXFRAME, _streamRing[k % BEAM_STREAM_RING]);
+      _streamFill[b]++;
+    }
+  }
+}
+
+/*
+Renders the next frame of the endless stream: the text, then enough blank
+frames to let its end scroll out of the chain, then the text again
+*/
+void Beam::nextStreamFrame(uint16_t *words) {
+  memset(words, 0x00, 12 * sizeof(uint16_t));
+  if (_streamRenderer.nextFrame(words)) return;
+
+  if (_streamTail < _beamCount) {
+    _streamTail++;
+    return;
+  }
+
+  _streamTail = 0;
+  _streamRenderer = BeamRenderer(_streamText);
+  _streamRenderer.nextFrame(words);
+}
+
+/*
+Blanks every frame not flagged in written[] (one bit mask per beam)
+*/
+void Beam::clearOtherFrames(const uint64_t *written) {
+  static const uint16_t blank[12] = { 0 };
+
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    for (int f = 0; f < MAXFRAME; f++) {
+      if (!(written[b] & (1ULL << f))) writeFrame(b, f, blank);
+    }
+  }
+}
+
+void Beam::initializeBeam(uint8_t b) {
+  BEAM_TRACE_CALL("void Beam::initializeBeam(uint8_t b)");
   //set basic config on each defined beam unit
-  sendWriteCmd(baddr, CTRL, CFG, 0x01);
+  writeCtrl(b, CFG, 0x01);
 
-  //set each frame to off since cs[] is reset by default 
+  //set each frame to off
+  static const uint16_t blank[12] = { 0 };
   for (int i = 0; i < 36; i++) {
-    writeFrame(baddr, i);
+    writeFrame(b, i, blank);
   }
 
   //set basic blink + pwm registers for each defined beam
-  for (int i = 0x40; i <= 0x45; i++) {
-    for (int j = 0x00; j <= 0x17; j++) {
-      sendWriteCmd(baddr, i, j, 0x00);
-    }
-    for (int k = 0x18; k <= 0x9b; k++) {
-      sendWriteCmd(baddr, i, k, 0xFF);
-    }
+  submit(OP_SETS, b);
+}
+
+/*
+Loads all six blink & PWM sets with blinking off and full brightness.
+Each set is streamed in auto-increment bursts and sets the shadow already
+knows to hold these values are skipped entirely.
+*/
+void Beam::loadBlinkPwmSets(uint8_t b) {
+  BEAM_TRACE_CALL("void Beam::loadBlinkPwmSets(uint8_t b)");
+  uint8_t data[0x9C];
+  memset(&data[0x00], 0x00, 0x18);    // blink bits
+
+  for (int i = 0; i <= 5; i++) {
+    if (_shadow && (_shadow[b].setsLoaded & (1 << i))) continue;
+
+    // sets with grayscale get theirs back, the others full brightness
+    bool custom = _pwm && (_pwm[b].custom & (1 << i));
+    if (custom) memcpy(&data[BEAM_PWM_BASE], _pwm[b].level[i], BEAM_PWM_BYTES);
+    else memset(&data[BEAM_PWM_BASE], 0xFF, BEAM_PWM_BYTES);    // pwm values
+
+    if (!sendBurstCmd(b, 0x40 + i, 0x00, data, sizeof(data))) continue;
+    if (_shadow) _shadow[b].setsLoaded |= 1 << i;
+    if (_pwm) memset(_pwm[b].dirty[i], 0x00, sizeof(_pwm[b].dirty[i]));
   }
 }
 
-void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames, uint8_t numLoops, uint8_t frameDelay, uint8_t scrollDir, uint8_t fadeMode) {
-  Log.trace("void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames, uint8_t numLoops, uint8_t frameDelay, uint8_t scrollDir, uint8_t fadeMode)");
+// the movie always ends at the last frame written, numFrames is not used
+void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t /* numFrames */, uint8_t numLoops, uint8_t frameDelay, uint8_t scrollDir, uint8_t fadeMode) {
+  BEAM_TRACE_CALL("void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames, uint8_t numLoops, uint8_t frameDelay, uint8_t scrollDir, uint8_t fadeMode)");
   _scrollMode = 1;
   _scrollDir = scrollDir;
   _fadeMode = fadeMode;
@@ -577,7 +1767,9 @@ void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames,
     //make sure numLoops between 000 and 111
 
     uint8_t movieData = 0 << 7 | 1 << 6 | startFrame;
-    uint8_t moviemodeData = 0 << 7 | 0 << 6 | _lastFrameWrite;
+    // with long texts or chains the shifted frames run past the last one
+    uint8_t lastFrame = (_lastFrameWrite < MAXFRAME) ? _lastFrameWrite : MAXFRAME - 1;
+    uint8_t moviemodeData = 0 << 7 | 0 << 6 | lastFrame;
     uint8_t frameData = 0;
     //uint8_t syncData = 0;
 
@@ -596,7 +1788,7 @@ void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames,
     uint8_t currsrcData = 0;
 
     // change led current based on number of connected beams
-    if (_beamCount == 4) {
+    if (_beamCount >= 4) {
       currsrcData = 0x08;
     }
     else if (_beamCount == 3) {
@@ -615,13 +1807,13 @@ void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames,
     if (_scrollDir == LEFT) {
       for (unsigned int b = 0; b < _beamCount; b++) {
           
-        sendWriteCmd(BEAM[b], CTRL, MOV, movieData);
-        sendWriteCmd(BEAM[b], CTRL, MOVMODE, moviemodeData);
-        sendWriteCmd(BEAM[b], CTRL, CURSRC, currsrcData);
-        sendWriteCmd(BEAM[b], CTRL, FRAMETIME, frameData);
-        sendWriteCmd(BEAM[b], CTRL, DISPLAYO, displayData);
-        if (b != 3)  // for some reason not for BEAMD (???)
-          sendWriteCmd(BEAM[b], CTRL, SHDN, 0x02);
+        writeCtrl(b, MOV, movieData);
+        writeCtrl(b, MOVMODE, moviemodeData);
+        writeCtrl(b, CURSRC, currsrcData);
+        writeCtrl(b, FRAMETIME, frameData);
+        writeCtrl(b, DISPLAYO, displayData);
+        if (_port[b].addr != BEAMD)  // for some reason not for BEAMD (???)
+          writeCtrl(b, SHDN, 0x02);
       }
     }
     else {
@@ -631,128 +1823,812 @@ void Beam::setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames,
     if (_gblMode == 1 && _beamCount > 1) {
       /* define clk sync in/out settings based on left/right scrolling direction */
       if (_scrollDir == LEFT) {
-        sendWriteCmd(BEAM[_beamCount - 1], CTRL, CLKSYNC, 0x02);
+        writeCtrl(_beamCount - 1, CLKSYNC, 0x02);
         for (int b = 0; b < _beamCount - 1; b++) {
-          sendWriteCmd(BEAM[b], CTRL, CLKSYNC, 0x01);
+          writeCtrl(b, CLKSYNC, 0x01);
         }
       }
       else {
-        sendWriteCmd(BEAM[0], CTRL, CLKSYNC, 0x02);
+        writeCtrl(0, CLKSYNC, 0x02);
         for (unsigned int b = 1; b < _beamCount; b++) {
-          sendWriteCmd(BEAM[b], CTRL, CLKSYNC, 0x01);
+          writeCtrl(b, CLKSYNC, 0x01);
         }
       }
     }
-    else {
-      // ToDo
+    else if (_gblMode == 0) {
+      // a unit of its own drives or follows the clock sync line as it was told
+      applySyncMode(_syncMode);
     }
   }
 }
 
+/*
+Frame time of the movie in ms, the period BeamSync steps units at
+*/
 unsigned int Beam::setSyncTimer() {
-  Log.trace("unsigned int Beam::setSyncTimer()");
+  BEAM_TRACE_CALL("unsigned int Beam::setSyncTimer()");
   if (1 <= _frameDelay && _frameDelay <= 15)
     return _frameDelay * 32.5;
 
   return 1000;
 }
 
-void Beam::writeFrame(uint8_t addr, uint8_t f) {
-  Log.trace("void Beam::writeFrame(uint8_t addr, uint8_t f)");
+/*
+Puts the beams on the clock sync line as mode (BEAM_SYNC) says
+*/
+void Beam::applySyncMode(uint8_t mode) {
+  static const uint8_t clockSync[] = { 0x00, 0x02, 0x01 };    // off, out, in
+  _syncMode = mode;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    writeCtrl(b, CLKSYNC, clockSync[mode]);
+  }
+}
+
+/*
+Stores the 12 CS words as frame f of the given beam in the shadow and sends
+only the bytes that differ from what the chip already holds.
+*/
+void Beam::writeFrame(uint8_t b, uint8_t f, const uint16_t *words) {
   uint8_t p = f;
-  Log.trace("writing frame %c (0x%02x)", p, p);
-  int data = 0;
+  if (p >= MAXFRAME) return;
+
+  uint8_t data[24];
   for (int j = 0x00; j <= 0x0B; j++) {
-    sendWriteCmd(addr, p + 1, 2 * j, cs[data] & 0xFF);          // i = frame address, 2*j = frame register address (even numbers) then first data byte
-    sendWriteCmd(addr, p + 1, 2 * j + 1, (cs[data] & 0x300) >> 8);    // i = frame address, 2*j+1 = frame register address (odd numbers) then second data byte
-    data++;
+    data[2 * j] = words[j] & 0xFF;              // 2*j = frame register address (even numbers) then first data byte
+    data[2 * j + 1] = (words[j] & 0x300) >> 8;  // 2*j+1 = frame register address (odd numbers) then second data byte
+  }
+  data[1] |= _frameSet[p] << 5;                  // blink/PWM set of the frame
+
+  if (!_shadow) {
+    BEAM_TRACE_FRAME("frame addr=0x%02x f=%u dirty=0xffffff", _port[b].addr, p);
+    sendBurstCmd(b, p + 1, 0x00, data, sizeof(data));
+    return;
+  }
+
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  uint8_t  *shadow = _shadow[b].frame[p];
+  uint32_t &dirty = _shadow[b].frameDirty[p];
+  for (int r = 0; r < 24; r++) {
+    if (shadow[r] != data[r]) {
+      shadow[r] = data[r];
+      dirty |= 1UL << r;
+    }
+  }
+
+  // a flush still waiting in the queue will pick up the new content
+  BEAM_TRACE_FRAME("frame addr=0x%02x f=%u dirty=0x%06lx queued=%d", _port[b].addr, p,
+                   (unsigned long)dirty, (int)((_frameQueued[b] >> p) & 1));
+  if (dirty && !(_frameQueued[b] & (1ULL << p))) {
+    _frameQueued[b] |= 1ULL << p;
+    submit(OP_FRAME, b, p);
+  }
+}
+
+/*
+Sends the dirty bytes of shadow frame f to the chip.
+Runs of dirty bytes separated by short clean gaps are merged, since
+re-sending a couple of unchanged bytes is cheaper than a new transaction.
+*/
+void Beam::flushFrame(uint8_t b, uint8_t f) {
+  if (!_shadow) return;
+
+  const uint8_t *shadow = _shadow[b].frame[f];
+  uint32_t &dirty = _shadow[b].frameDirty[f];
+  int r = 0;
+  while (dirty >> r) {
+    while (!(dirty & (1UL << r))) r++;
+    int first = r;
+    int last = r;
+    for (r++; r < 24 && r - last <= 3; r++) {
+      if (dirty & (1UL << r)) last = r;
+    }
+    r = last + 1;
+
+    uint32_t run = ((1UL << (last + 1)) - 1) & ~((1UL << first) - 1);
+    BEAM_TRACE_FRAME("flush addr=0x%02x f=%u reg=%d len=%d", _port[b].addr, f, first, last - first + 1);
+    if (!sendBurstCmd(b, f + 1, first, &shadow[first], last - first + 1)) return;
+    dirty &= ~run;
   }
-  Log.trace("Done writing frame");
 }
 
-void Beam::convertFrame(const uint8_t * currentFrame) {
-  Log.trace("void Beam::convertFrame(const uint8_t * currentFrame)");
+/*
+Sends the PWM bytes of a set that changed, in runs like flushFrame(). A set
+the chip may not hold yet is loaded as a whole.
+*/
+void Beam::flushPwm(uint8_t b, uint8_t set) {
+  if (!_pwm) return;
+  BeamPwm &pwm = _pwm[b];
+  pwm.queued &= ~(1 << set);
+
+  if (_shadow && !(_shadow[b].setsLoaded & (1 << set))) {
+    loadBlinkPwmSets(b);
+    return;
+  }
+
+  uint32_t *dirty = pwm.dirty[set];
   int i = 0;
+  while (i < BEAM_PWM_BYTES) {
+    if (!(dirty[i / 32] & (1UL << (i % 32)))) {
+      i++;
+      continue;
+    }
+    int first = i;
+    int last = i;
+    for (i++; i < BEAM_PWM_BYTES && i - last <= 3; i++) {
+      if (dirty[i / 32] & (1UL << (i % 32))) last = i;
+    }
+    i = last + 1;
 
-  //CS0 to CS3
-  int n = 0;
-  for (int y = 10; y > 0; --y) {
-    i = (y < 6) ? 1 : 0;
-    cs[0] |= (((uint16_t)(*(currentFrame + n) & segmentmask[0 + i]) << (3 + i)) >> y);
-    cs[1] |= (((uint16_t)(*(currentFrame + n) & segmentmask[2 + i]) << (5 + i)) >> y);
-    cs[2] |= (((uint16_t)(*(currentFrame + n) & segmentmask[4 + i]) << (7 + i)) >> y);
-    cs[3] |= (((uint16_t)(*(currentFrame + n) & segmentmask[6 + i]) << (9 + i)) >> y);
-    n += 3;
+    BEAM_TRACE_FRAME("pwm addr=0x%02x set=%u reg=%d len=%d", _port[b].addr, set, BEAM_PWM_BASE + first, last - first + 1);
+    if (!sendBurstCmd(b, 0x40 + set, BEAM_PWM_BASE + first, &pwm.level[set][first], last - first + 1)) return;
+    for (int j = first; j <= last; j++) dirty[j / 32] &= ~(1UL << (j % 32));
+  }
+}
+
+/*
+Uploads the frames collected in _frameQueued while the chain is spread
+over two buses
+*/
+void Beam::flushQueuedFrames() {
+  uint64_t batch[MAXBEAMS];
+  bool any = false;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    batch[b] = _frameQueued[b];
+    _frameQueued[b] = 0;
+    any |= (batch[b] != 0);
+  }
+  if (any) flushFrames(batch);
+}
 
-    if (n > 12) {
-      n = 0;
+/*
+Flushes the frames flagged in batch[] (one bit mask per beam). Beams on
+the second bus are handed to the worker thread, so both buses transfer
+while this thread serves the first one.
+*/
+void Beam::flushFrames(const uint64_t *batch) {
+  bool parallel = false;
+#if PLATFORM_THREADING
+  if (_worker) {
+    for (unsigned int b = 0; b < _beamCount; b++) {
+      _workBatch[b] = (_port[b].bus == 1) ? batch[b] : 0;
+      parallel |= (_workBatch[b] != 0);
+    }
+    if (parallel) {
+      _workerBusy = true;
+      os_semaphore_give(_workStart, false);
     }
   }
+#endif
+
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (parallel && _port[b].bus == 1) continue;
+    flushBeam(b, batch[b]);
+  }
 
-  //CS4 to CS7
-  n = 1;
-  for (int y = 10; y > 0; --y) {
-    i = (y < 6) ? 1 : 0;
-    cs[4] |= (((uint16_t)(*(currentFrame + n) & segmentmask[0 + i]) << (3 + i)) >> y);
-    cs[5] |= (((uint16_t)(*(currentFrame + n) & segmentmask[2 + i]) << (5 + i)) >> y);
-    cs[6] |= (((uint16_t)(*(currentFrame + n) & segmentmask[4 + i]) << (7 + i)) >> y);
-    cs[7] |= (((uint16_t)(*(currentFrame + n) & segmentmask[6 + i]) << (9 + i)) >> y);
-    n += 3;
+#if PLATFORM_THREADING
+  if (parallel) {
+    os_semaphore_take(_workDone, CONCURRENT_WAIT_FOREVER, false);
+    _workerBusy = false;
+    _jobErrors += _workErrors;
+    _workErrors = 0;
+  }
+#endif
+}
+
+void Beam::flushBeam(uint8_t b, uint64_t frames) {
+  for (int f = 0; frames >> f; f++) {
+    if (frames & (1ULL << f)) flushFrame(b, f);
+  }
+}
+
+/*
+Worker thread of the second bus. While it runs the calling thread holds
+the lock and serves the beams on the first bus only, so the shadow,
+failure state, statistics and clock of the second bus are the worker's
+alone. Its failed transactions go to _workErrors, which flushFrames()
+adds to the job once the worker is done. A chain behind a mux sits on a
+single bus, so the worker never switches the mux.
+*/
+void Beam::workerLoop() {
+#if PLATFORM_THREADING
+  while (true) {
+    os_semaphore_take(_workStart, CONCURRENT_WAIT_FOREVER, false);
+    if (_workerQuit) break;
 
-    if (n > 13) {
-      n = 1;
+    for (unsigned int b = 0; b < _beamCount; b++) {
+      if (_workBatch[b]) flushBeam(b, _workBatch[b]);
     }
+    os_semaphore_give(_workDone, false);
+  }
+  os_semaphore_give(_workDone, false);
+#endif
+}
+
+/*
+Writes a CTRL register unless the chip is known to hold that value already.
+SHDN is always written since (re)writing it is what starts a beam.
+*/
+void Beam::writeCtrl(uint8_t b, uint8_t reg, uint8_t data) {
+  if (!_shadow || reg >= sizeof(_shadow[b].ctrl)) {
+    sendWriteCmd(b, CTRL, reg, data);
+    return;
   }
 
-  //CS8 - CS11
-  n = 2;
-  for (int y = 10; y > 0; --y) {
-    i = (y < 6) ? 1 : 0;
-    cs[8] |= (((uint16_t)(*(currentFrame + n) & segmentmask[0 + i]) << (3 + i)) >> y);
-    cs[9] |= (((uint16_t)(*(currentFrame + n) & segmentmask[2 + i]) << (5 + i)) >> y);
-    cs[10] |= (((uint16_t)(*(currentFrame + n) & segmentmask[4 + i]) << (7 + i)) >> y);
-    cs[11] |= (((uint16_t)(*(currentFrame + n) & segmentmask[6 + i]) << (9 + i)) >> y);
-    n += 3;
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  uint8_t  &shadow = _shadow[b].ctrl[reg];
+  uint16_t &dirty = _shadow[b].ctrlDirty;
+  if (shadow == data && !(dirty & (1 << reg)) && reg != SHDN) return;
 
-    if (n > 14) {
-      n = 2;
+  shadow = data;
+  dirty |= 1 << reg;
+  submit(OP_CTRL, b, reg, data);
+}
+
+/*
+Hands an operation to the transfer engine. Without async mode, or when
+issued by an operation that is executing right now, it runs immediately,
+otherwise it is appended to the queue.
+*/
+void Beam::submit(uint8_t type, uint8_t b, uint8_t reg, uint8_t data) {
+  BeamOp op = { type, b, reg, data };
+  std::lock_guard<RecursiveMutex> lock(_lock);
+
+  if (_asyncMode == ASYNC_OFF || !_queue || _executing) {
+    // with two buses frames are collected and uploaded on both at once
+    // before the next operation, see flushFrames()
+    if (_buses > 1) {
+      if (type == OP_FRAME) return;
+      flushQueuedFrames();
+    }
+
+    bool nested = _executing;
+    if (!nested) probeOffline();
+    _executing = true;
+    while (!execute(op)) {
+      delay(1);
     }
+    _executing = nested;
+    return;
+  }
+
+  uint16_t next = (_queueTail + 1) % BEAM_QUEUE_SIZE;
+  if (next == _queueHead) {
+    // queue full, make room the hard way
+    pump();
   }
+  _queue[_queueTail] = op;
+  _queueTail = next;
 }
 
-void Beam::sendWriteCmd(uint8_t addr, uint8_t ramsection, uint8_t subreg, uint8_t subregdata) {
-  //Log.trace("void Beam::sendWriteCmd(uint8_t addr, uint8_t ramsection, uint8_t subreg, uint8_t subregdata)");
-  static int errCount = 0;
-  if (!i2cwrite(addr, REGSEL, ramsection)) {
-    i2cwrite(addr, subreg, subregdata);
-    errCount = 0;
+/*
+Runs one queued operation, returns false while a multi-step operation
+still needs more time
+*/
+bool Beam::execute(const BeamOp &op) {
+  switch (op.type) {
+    case OP_FRAME:
+      _frameQueued[op.beam] &= ~(1ULL << op.reg);
+      flushFrame(op.beam, op.reg);
+      return true;
+    case OP_CTRL:
+      if (sendWriteCmd(op.beam, CTRL, op.reg, op.data)
+       && _shadow && _shadow[op.beam].ctrl[op.reg] == op.data) {
+        _shadow[op.beam].ctrlDirty &= ~(1 << op.reg);
+      }
+      return true;
+    case OP_SETS:
+      loadBlinkPwmSets(op.beam);
+      return true;
+    case OP_PWM:
+      flushPwm(op.beam, op.reg);
+      return true;
+    case OP_BANK:
+      armBank(op.reg);
+      return true;
+    case OP_RESET:
+      return stepReset();
+    case OP_PLAY:
+      return stepPlay();
+    case OP_DONE:
+      if (_doneCallback) _doneCallback(*this, op.reg, _jobErrors == 0);
+      _jobErrors = 0;
+      return true;
   }
-  else {
-    Log.warn("Beam not found: 0x%02x (%d)", addr, _beamCount);
-    if (errCount++ > 50) _wire->reset();
+  return true;
+}
+
+/*
+Reset pulse as a sequence of non-blocking steps
+*/
+bool Beam::stepReset() {
+  switch (_opPhase) {
+    case 0:
+      pinMode(_rst, OUTPUT);
+      digitalWrite(_rst, LOW);
+      _opStart = millis();
+      _opPhase = 1;
+      return false;
+    case 1:
+      if (millis() - _opStart < 100) return false;
+      digitalWrite(_rst, HIGH);
+      _opStart = millis();
+      _opPhase = 2;
+      return false;
+    default:
+      if (millis() - _opStart < 250) return false;
+      break;
   }
+  _opPhase = 0;
+
+  // the chips come back with no RAM section selected and unknown content
+  memset(_regsel, 0x00, sizeof(_regsel));
+  _muxChannel = BEAM_NO_CHANNEL;
+  invalidateShadow();
+  return true;
 }
 
-uint8_t Beam::sendReadCmd(uint8_t addr, uint8_t ramsection, uint8_t subreg) {
-  //Log.trace("uint8_t Beam::sendReadCmd(uint8_t addr, uint8_t ramsection, uint8_t subreg)");
-  i2cwrite(addr, REGSEL, ramsection);
+/*
+Waits until all daisy chained beams are started, either polling the chain
+every 10ms or - with HANDOFF_IRQ - handling the interrupts as they come in.
+Should the IRQ line not be wired up the status is still polled, although
+only every 100ms. Once the first beam is started it gets 10ms before the
+next operation, waited out by later steps instead of blocking this one.
+*/
+bool Beam::stepPlay() {
+  if (_opPhase == 2) {
+    if (millis() - _opStart < 10) return false;
+    _opPhase = 0;
+    return true;
+  }
+
+  if (_handoffMode == HANDOFF_IRQ && _irqPending) {
+    handleIrq();
+  }
+  if (!_handoffBusy) {
+    _opPhase = 0;
+    return true;
+  }
+
+  uint32_t interval = (_handoffMode == HANDOFF_IRQ) ? 100 : 10;
+  if (_opPhase && millis() - _opStart < interval) return false;
 
-  _wire->beginTransmission(addr);
-  _wire->write(subreg);
-  _wire->endTransmission();
+  if (checkStatus() == 1) {
+    _handoffBusy = false;
+    _opPhase = 2;
+    _opStart = millis();
+    return false;
+  }
+  _opPhase = 1;
+  _opStart = millis();
+  return false;
+}
 
-  _wire->requestFrom(addr, (uint8_t)1);
-    // wait up to 250ms for data  
-  for (uint32_t _ms = millis(); !_wire->available() && millis() - _ms < 250; Particle.process());
-  if (_wire->available()) return _wire->read();
-  else _wire->reset();
+/*
+IRQ pin ISR, the bus work is deferred to handleIrq()
+*/
+void Beam::onIrq() {
+  _irqPending = true;
+  if (_irqTimer) _irqTimer->startFromISR();
+}
+
+void Beam::onIrqTimer() {
+  // if the application holds the bus stepPlay() will pick the interrupt up,
+  // or the timer tries again without an OP_PLAY waiting for it
+  if (_lock.trylock()) {
+    if (_irqPending) handleIrq();
+    _lock.unlock();
+  }
+  else if (_irqPending && handoffByTimer()) {
+    _irqTimer->reset();
+  }
+}
+
+/*
+Starts the next beam of the chain after its predecessor raised IRQ_FRAME,
+or switches the beams that raised it to the next bank. Reading IRQSTAT
+releases the IRQ line, and the beam that has handed over stops
+interrupting.
+*/
+void Beam::handleIrq() {
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  _irqPending = false;
+
+  // run the writes right away instead of queueing them
+  bool nested = _executing;
+  _executing = true;
+
+  if (!_handoffBusy) {
+    for (unsigned int b = 0; b < _beamCount; b++) {
+      if (_offline[b]) continue;
+      uint8_t irq = sendReadCmd(b, CTRL, IRQSTAT);
+      if ((irq & IRQ_FRAME) && (_bankWaiting & (1 << b))) switchBank(b);
+    }
+  }
+  else if (sendReadCmd(activeBeams - 1, CTRL, IRQSTAT) & IRQ_FRAME) {
+    writeCtrl(--activeBeams - 1, SHDN, 0x03);
+    writeCtrl(activeBeams, IRQMASK, 0x00);
+    if (activeBeams <= 1) {
+      activeBeams = _beamCount;
+      _handoffBusy = false;
+    }
+  }
+
+  _executing = nested;
+}
+
+void Beam::finishJob(uint8_t job) {
+  submit(OP_DONE, 0, job);
+}
+
+void Beam::onPumpTimer() {
+  // never stall the timer thread behind the application
+  if (_lock.trylock()) {
+    pump(_pumpBudget);
+    _lock.unlock();
+  }
+}
+
+/*
+Marks every shadowed register as unknown, e.g. after the chips were reset
+*/
+void Beam::invalidateShadow() {
+  if (!_shadow) return;
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    for (int f = 0; f < MAXFRAME; f++) {
+      _shadow[b].frameDirty[f] = 0x00FFFFFF;
+    }
+    _shadow[b].ctrlDirty = 0xFFFF;
+    _shadow[b].setsLoaded = 0;
+  }
+}
+
+bool Beam::sendWriteCmd(uint8_t b, uint8_t ramsection, uint8_t subreg, uint8_t subregdata) {
+  BEAM_TRACE_BUS("write addr=0x%02x sec=0x%02x reg=0x%02x data=0x%02x", _port[b].addr, ramsection, subreg, subregdata);
+  if (_offline[b]) {
+    countError(b);
+    return false;
+  }
+  if (selectSection(b, ramsection) && !i2cwrite(b, subreg, subregdata)) {
+    _failures[b] = 0;
+    return true;
+  }
+
+  writeFailed(b);
+  return false;
+}
+
+/*
+Writes len consecutive registers of one RAM section starting at subreg.
+The section is selected once and the register address auto-increments
+with every data byte, so the data is streamed in as few transactions as
+the TwoWire TX buffer allows instead of two transactions per byte.
+*/
+bool Beam::sendBurstCmd(uint8_t b, uint8_t ramsection, uint8_t subreg, const uint8_t *data, uint8_t len) {
+  BEAM_TRACE_BUS("burst addr=0x%02x sec=0x%02x reg=0x%02x len=%u", _port[b].addr, ramsection, subreg, len);
+  if (_offline[b]) {
+    countError(b);
+    return false;
+  }
+  if (!selectSection(b, ramsection)) {
+    writeFailed(b);
+    return false;
+  }
+
+  while (len) {
+    uint8_t chunk = (len < BEAM_I2C_BUFFER - 1) ? len : BEAM_I2C_BUFFER - 1;
+    if (transmit(b, subreg, data, chunk)) {
+      writeFailed(b);
+      return false;
+    }
+    subreg += chunk;
+    data += chunk;
+    len -= chunk;
+  }
+  _failures[b] = 0;
+  return true;
+}
+
+uint8_t Beam::sendReadCmd(uint8_t b, uint8_t ramsection, uint8_t subreg) {
+  BEAM_TRACE_BUS("read addr=0x%02x sec=0x%02x reg=0x%02x", _port[b].addr, ramsection, subreg);
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  if (_offline[b]) return 0;
+  if (!selectSection(b, ramsection) || transmit(b, subreg, NULL, 0)) {
+    writeFailed(b);
+    return 0;
+  }
+
+  TwoWire *wire = bus(b);
+  if (!wire) {
+    writeFailed(b);
+    return 0;
+  }
+  countTransfer(b, 1, wire->requestFrom(_port[b].addr, (uint8_t)1) ? 0 : 2);
+  // wait for data, but not for long
+  for (uint32_t _ms = millis(); !wire->available() && millis() - _ms < _readTimeout; Particle.process());
+  if (wire->available()) {
+    _failures[b] = 0;
+    return wire->read();
+  }
+
+  _busStats[b].readTimeouts++;
+  if (_adaptiveClock) adaptClock(b, true);
+  resetBus(b);
+  writeFailed(b);
   return 0;
 }
 
-uint8_t Beam::i2cwrite(uint8_t address, uint8_t cmdbyte, uint8_t databyte) { 
-  //Log.trace("uint8_t Beam::i2cwrite(uint8_t address, uint8_t cmdbyte, uint8_t databyte)");
-  _wire->beginTransmission(address);
-  _wire->write(cmdbyte);
-  _wire->write(databyte);
-  return (_wire->endTransmission());
+/*
+Selects the RAM section for following register accesses.
+The selected section is remembered per beam so consecutive accesses to the
+same section (e.g. a row of CTRL writes) only pay for one REGSEL write.
+*/
+bool Beam::selectSection(uint8_t b, uint8_t ramsection) {
+  if (_regsel[b] == ramsection) return true;
+
+  if (i2cwrite(b, REGSEL, ramsection)) {
+    _regsel[b] = 0;
+    return false;
+  }
+  _regsel[b] = ramsection;
+  return true;
+}
+
+/*
+After a failed transaction the selected section on that beam is unknown
+*/
+void Beam::writeFailed(uint8_t b) {
+  _regsel[b] = 0;
+
+  _stale[b] = true;
+  countError(b);
+  Log.warn("Beam not found: 0x%02x (%d)", _port[b].addr, _beamCount);
+  if (++_failures[b] < _offlineAfter) return;
+
+  // stop waiting for it, the rest of the chain carries on
+  Log.warn("Beam 0x%02x offline", _port[b].addr);
+  _offline[b] = true;
+  _busStats[b].offline++;
+  _probeAt[b] = millis() + BEAM_PROBE_INTERVAL;
+  resetBus(b);
+}
+
+/*
+Counts a failed transaction towards the job it belongs to
+*/
+void Beam::countError(uint8_t b) {
+  if (_workerBusy && _port[b].bus == 1) _workErrors++;
+  else _jobErrors++;
+}
+
+/*
+Probes the offline beams that are due with an address-only write
+*/
+void Beam::probeOffline() {
+  for (unsigned int b = 0; b < _beamCount; b++) {
+    if (!_offline[b] || (int32_t)(millis() - _probeAt[b]) < 0) continue;
+
+    BEAM_TRACE_BUS("probe addr=0x%02x", _port[b].addr);
+    // a mux that did not switch fails the probe without sending it
+    TwoWire *wire = bus(b);
+    uint8_t result = 4;
+    if (wire) {
+      wire->beginTransmission(_port[b].addr);
+      result = wire->endTransmission();
+      _busStats[b].transactions++;
+      _busStats[b].bytes++;
+      if (result) _busStats[b].nacks++;
+    }
+    if (result) {
+      _probeAt[b] = millis() + BEAM_PROBE_INTERVAL;
+      continue;
+    }
+    Log.info("Beam 0x%02x online", _port[b].addr);
+    recoverBeam(b);
+  }
+}
+
+/*
+Brings a beam that answers again or missed a write back up to date. It may
+have lost power meanwhile, so everything the shadow holds is written anew:
+frames and sets first and the CTRL registers last, SHDN (which starts it)
+at the end.
+*/
+void Beam::recoverBeam(uint8_t b) {
+  std::lock_guard<RecursiveMutex> lock(_lock);
+  _offline[b] = false;
+  _stale[b] = false;
+  _failures[b] = 0;
+  _regsel[b] = 0;
+
+  if (!_shadow) {
+    initializeBeam(b);
+    return;
+  }
+
+  BeamShadow &shadow = _shadow[b];
+  for (int f = 0; f < MAXFRAME; f++) {
+    shadow.frameDirty[f] = 0x00FFFFFF;
+  }
+  shadow.ctrlDirty = 0xFFFF;
+  shadow.setsLoaded = 0;
+
+  writeCtrl(b, CFG, shadow.ctrl[CFG]);
+  submit(OP_SETS, b);
+  for (int f = 0; f < MAXFRAME; f++) {
+    if (_frameQueued[b] & (1ULL << f)) continue;
+    _frameQueued[b] |= 1ULL << f;
+    submit(OP_FRAME, b, f);
+  }
+
+  static const uint8_t order[] = { PIC, MOV, MOVMODE, FRAMETIME, DISPLAYO, CURSRC, IRQMASK, IRQFRAME, CLKSYNC, SHDN };
+  for (unsigned int i = 0; i < sizeof(order); i++) {
+    writeCtrl(b, order[i], shadow.ctrl[order[i]]);
+  }
+}
+
+/*
+Resets the bus of beam b after failures talking to it. Every beam on that
+bus loses its selected section.
+*/
+void Beam::resetBus(uint8_t b) {
+  BEAM_TRACE_CALL("void Beam::resetBus(uint8_t b)");
+  _busStats[b].busResets++;
+
+  TwoWire *wire = _port[b].wire;
+  wire->reset();
+  for (unsigned int i = 0; i < _beamCount; i++) {
+    if (_port[i].wire == wire) _regsel[i] = 0;
+  }
+  // only a chain behind a mux has one, and that is on a single bus
+  if (_port[b].channel != BEAM_NO_CHANNEL) _muxChannel = BEAM_NO_CHANNEL;
+}
+
+/*
+Returns the bus of beam b, with the mux switched to its channel. NULL when
+the mux did not take the switch: the channel still enabled holds other
+beams at the same addresses, so nothing may be sent.
+*/
+TwoWire *Beam::bus(uint8_t b) {
+  TwoWire *wire = _port[b].wire;
+  if (_port[b].channel == BEAM_NO_CHANNEL || _port[b].channel == _muxChannel) return wire;
+
+  BEAM_TRACE_BUS("mux addr=0x%02x channel=%u", _muxAddress, _port[b].channel);
+  wire->beginTransmission(_muxAddress);
+  wire->write(1 << _port[b].channel);
+  uint8_t result = wire->endTransmission();
+  countTransfer(b, 1, result);
+  if (result) {
+    _muxChannel = BEAM_NO_CHANNEL;
+    return NULL;
+  }
+  _muxChannel = _port[b].channel;
+  return wire;
+}
+
+/*
+Accounts for one transaction of len bytes (without the address byte),
+result as returned by endTransmission()
+*/
+void Beam::countTransfer(uint8_t b, uint8_t len, uint8_t result) {
+  _busStats[b].transactions++;
+  if (result) {
+    _busStats[b].nacks++;
+    _busStats[b].bytes++;
+  }
+  else {
+    _busStats[b].bytes += len + 1;
+  }
+  // nobody answering (address NACK) is a missing beam, not a bad clock
+  if (_adaptiveClock) adaptClock(b, result != 0 && result != 2);
+}
+
+/*
+Sets up the clock of each bus as requested, starting adaptive mode at the
+requested clock
+*/
+void Beam::applyClock() {
+  for (unsigned int i = 0; i < _buses; i++) {
+    _clock[i].wire = NULL;
+    for (unsigned int b = 0; b < _beamCount && !_clock[i].wire; b++) {
+      if (_port[b].bus == i) _clock[i].wire = _port[b].wire;
+    }
+  }
+  if (_clockMode == CLOCK_KEEP) {
+    _adaptiveClock = false;
+    return;
+  }
+
+  uint8_t requested = (_clockMode < CLOCK_FAST_PLUS) ? _clockMode : (uint8_t)CLOCK_FAST_PLUS;
+  uint8_t level = requested;
+  while (level > CLOCK_STANDARD && clockSteps[level] > BEAM_MAX_CLOCK) level--;
+  if (level != requested) {
+    Log.warn("I2C clock of %lu Hz not supported (default to %lu Hz)",
+             (unsigned long)clockSteps[requested], (unsigned long)clockSteps[level]);
+  }
+
+  for (unsigned int i = 0; i < _buses; i++) {
+    _clock[i].maxLevel = level;
+    _clock[i].window = 0;
+    _clock[i].errors = 0;
+    _clock[i].cleanSince = millis();
+    if (_clock[i].wire) setWireClock(i, level);
+  }
+}
+
+/*
+The TwoWire peripheral only takes a new clock while it is stopped
+*/
+void Beam::setWireClock(uint8_t bus, uint8_t level) {
+  BEAM_TRACE_CALL("I2C bus %u at %lu Hz", bus, (unsigned long)clockSteps[level]);
+  TwoWire *wire = _clock[bus].wire;
+  _clock[bus].level = level;
+
+  bool enabled = wire->isEnabled();
+  if (enabled) wire->end();
+  wire->setSpeed(clockSteps[level]);
+  if (enabled) wire->begin();
+}
+
+/*
+Adaptive clock: steps the bus of beam b down as soon as a window of
+transactions has seen too many failures, and up again once it ran clean
+for a while. Only ever called by the thread driving that bus.
+*/
+void Beam::adaptClock(uint8_t b, bool failed) {
+  BeamClock &clock = _clock[_port[b].bus];
+  if (!clock.wire) return;
+
+  clock.window++;
+  if (failed) {
+    clock.errors++;
+    clock.cleanSince = millis();
+  }
+
+  if (clock.errors >= BEAM_CLOCK_ERRORS) {
+    if (clock.level > CLOCK_STANDARD) {
+      Log.warn("I2C errors on bus %u, slowing down", _port[b].bus);
+      setWireClock(_port[b].bus, clock.level - 1);
+    }
+    clock.window = 0;
+    clock.errors = 0;
+  }
+  else if (clock.window >= BEAM_CLOCK_WINDOW) {
+    clock.window = 0;
+    clock.errors = 0;
+  }
+
+  if (clock.level < clock.maxLevel && millis() - clock.cleanSince >= BEAM_CLOCK_CLEAN) {
+    setWireClock(_port[b].bus, clock.level + 1);
+    clock.cleanSince = millis();
+  }
+}
+
+uint8_t Beam::i2cwrite(uint8_t b, uint8_t cmdbyte, uint8_t databyte) { 
+  BEAM_TRACE_BUS("i2c addr=0x%02x reg=0x%02x data=0x%02x", _port[b].addr, cmdbyte, databyte);
+  return transmit(b, cmdbyte, &databyte, 1);
+}
+
+/*
+Writes reg followed by len data bytes to beam b, repeating a failed
+transaction up to _retries times with a growing pause in between
+*/
+uint8_t Beam::transmit(uint8_t b, uint8_t reg, const uint8_t *data, uint8_t len) {
+  uint8_t result = 0;
+  for (uint8_t attempt = 0; attempt <= _retries; attempt++) {
+    if (attempt) delayMicroseconds((uint32_t)_backoff << (attempt - 1));
+
+    TwoWire *wire = bus(b);
+    if (!wire) {
+      // the mux did not switch, the beam is out of reach
+      result = 4;
+      continue;
+    }
+    wire->beginTransmission(_port[b].addr);
+    wire->write(reg);
+    if (len) wire->write(data, len);
+    result = wire->endTransmission();
+    countTransfer(b, len + 1, result);
+    if (!result) break;
+  }
+  return result;
 }
@@ -20,11 +20,59 @@ Replaced "copy-paste" logic with functional blocks by use of arrays and loops
 ===========================================================================
 */
 #include <Particle.h>
+#include "beamrender.h"
+#include "beamcanvas.h"
+#include "beamanim.h"
+
+// compile time trace level, trace points above it compile to nothing:
+// 0 = none (release), 1 = API calls, 2 = + per frame upload events,
+// 3 = + every bus access
+#ifndef BEAM_TRACE
+#define BEAM_TRACE 0
+#endif
+
+#if BEAM_TRACE >= 1
+#define BEAM_TRACE_CALL(...) Log.trace(__VA_ARGS__)
+#else
+#define BEAM_TRACE_CALL(...) do { } while (0)
+#endif
+
+#if BEAM_TRACE >= 2
+#define BEAM_TRACE_FRAME(...) Log.trace(__VA_ARGS__)
+#else
+#define BEAM_TRACE_FRAME(...) do { } while (0)
+#endif
+
+#if BEAM_TRACE >= 3
+#define BEAM_TRACE_BUS(...) Log.trace(__VA_ARGS__)
+#else
+#define BEAM_TRACE_BUS(...) do { } while (0)
+#endif
 
 #define MAXFRAME 36
+#define MAXBEAMS 16
+
+// rendered frames kept for streaming, the beams of a chain lag behind each other
+#define BEAM_STREAM_RING (2 * MAXBEAMS)
+
+// frame RAM halves loadBank() plays from: bank A = frames 0 to 17, bank B = 18 to 35
+#define BEAM_BANK_FRAMES (MAXFRAME / 2)
+#define BEAM_NO_BANK     0xFF
+
+// number of pending bus operations the async engine can hold
+#ifndef BEAM_QUEUE_SIZE
+#define BEAM_QUEUE_SIZE 256
+#endif
 #define SPACE     3
 #define KERNING   1
 
+// largest I2C transaction (incl. register byte) the TwoWire TX buffer takes
+#ifdef I2C_BUFFER_LENGTH
+#define BEAM_I2C_BUFFER I2C_BUFFER_LENGTH
+#else
+#define BEAM_I2C_BUFFER 32
+#endif
+
 
 const uint8_t BEAM_ADDRESS[] = {0x36, 0x34, 0x30, 0x37};
 #define BEAMA BEAM_ADDRESS[0]
@@ -32,6 +80,46 @@ const uint8_t BEAM_ADDRESS[] = {0x36, 0x34, 0x30, 0x37};
 #define BEAMC BEAM_ADDRESS[2]
 #define BEAMD BEAM_ADDRESS[3]
 
+// beams one bus (or mux channel) can hold, one per address
+#define BEAM_PER_BUS ((uint8_t)sizeof(BEAM_ADDRESS))
+
+// TCA9548A I2C multiplexer, channels 0-7 at 0x70-0x77
+#define BEAM_MUX_ADDRESS  0x70
+#define BEAM_MUX_CHANNELS 8
+#define BEAM_NO_CHANNEL   0xFF
+
+// buses a chain can be spread over, see begin(wire, wire1, beamsOnWire)
+#define BEAM_BUSES 2
+
+// fastest I2C clock the MCU takes, Particle devices stop at fast mode
+#ifndef BEAM_MAX_CLOCK
+#if defined(PLATFORM_ID)
+#define BEAM_MAX_CLOCK 400000
+#else
+#define BEAM_MAX_CLOCK 1000000
+#endif
+#endif
+
+// adaptive clock: a bus steps down when BEAM_CLOCK_ERRORS transactions of a
+// window of BEAM_CLOCK_WINDOW fail, and back up after BEAM_CLOCK_CLEAN ms
+// without a failure
+#define BEAM_CLOCK_WINDOW 64
+#define BEAM_CLOCK_ERRORS 3
+#define BEAM_CLOCK_CLEAN  30000
+
+// blink/PWM sets: 24 blink bytes followed by a PWM byte for each LED at
+// BEAM_PWM_BASE + cs * 11 + segment (segment = (x % 2) * 5 + row)
+#define BEAM_PWM_SETS  6
+#define BEAM_PWM_BASE  0x18
+#define BEAM_PWM_BYTES 0x84
+
+// bus error handling defaults, see setBusTimeouts()
+#define BEAM_READ_TIMEOUT   25    // ms to wait for a register read
+#define BEAM_RETRIES        1     // repeats of a failed transaction
+#define BEAM_BACKOFF        200   // us before the first repeat, doubles with every one
+#define BEAM_OFFLINE_AFTER  8     // failed transactions in a row that take a beam offline
+#define BEAM_PROBE_INTERVAL 1000  // ms between probes of an offline beam
+
 //Sub Register address
 enum BEAM_REGISTER {
   PIC       = 0x00,
@@ -45,6 +133,8 @@ enum BEAM_REGISTER {
   IRQFRAME  = 0x08,
   SHDN      = 0x09,
   CLKSYNC   = 0x0B,
+  IRQSTAT   = 0x0E,
+  STATUS    = 0x0F,
   //RAM section address
   CTRL      = 0xC0,
   REGSEL    = 0xFD,
@@ -59,35 +149,202 @@ enum BEAM_MODE {
   FADEON    = 0x01,
 };
 
+enum BEAM_UPDATE {
+  UPDATE_LIVE  = 0,
+  UPDATE_RESET = 1,
+};
+
+//Clock sync line of a unit of its own, see the Beam constructor and BeamSync
+enum BEAM_SYNC {
+  SYNC_OFF    = 0,    // runs on its own oscillator
+  SYNC_MASTER = 1,    // drives the clock sync line
+  SYNC_SLAVE  = 2,    // follows the clock sync line
+};
+
+//IRQMASK / IRQSTAT bits
+enum BEAM_IRQ {
+  IRQ_MOVIE = 0x01,
+  IRQ_FRAME = 0x80,
+};
+
+enum BEAM_HANDOFF {
+  HANDOFF_POLL = 0,
+  HANDOFF_IRQ  = 1,
+};
+
+enum BEAM_ASYNC {
+  ASYNC_OFF   = 0,
+  ASYNC_PUMP  = 1,
+  ASYNC_TIMER = 2,
+};
+
+//Jobs reported to the completion callback
+enum BEAM_JOB {
+  JOB_INIT    = 0,
+  JOB_PRINT   = 1,
+  JOB_DRAW    = 2,
+  JOB_PLAY    = 3,
+  JOB_DISPLAY = 4,
+  JOB_CONFIG  = 5,
+};
+
+#define BEAM_JOBS (JOB_CONFIG + 1)
+
+// latency histogram buckets: bucket i counts operations faster than 2^i ms,
+// the last one all slower operations
+#define BEAM_LATENCY_BUCKETS 12
+
+// size of the statistics text exported by exportStats()
+#define BEAM_STATS_TEXT 256
+
+//I2C clock, see begin() and setBusClock()
+enum BEAM_CLOCK {
+  CLOCK_STANDARD  = 0,      // 100 kHz
+  CLOCK_FAST      = 1,      // 400 kHz
+  CLOCK_FAST_PLUS = 2,      // 1 MHz, capped at BEAM_MAX_CLOCK
+  CLOCK_KEEP      = 0xFF,   // as configured by the application
+};
+
 enum BEAM_ORIENTATION {
   RIGHT     = 0,
   LEFT      = 1,
 };
 
+// host-side copy of a chip's frame RAM and CTRL registers, so that only
+// registers whose content changes need to go on the bus
+struct BeamShadow {
+  uint8_t  frame[MAXFRAME][24];
+  uint32_t frameDirty[MAXFRAME];  // bytes of frame[f] not known to be on the chip
+  uint8_t  ctrl[16];
+  uint16_t ctrlDirty;             // ctrl[] registers not known to be on the chip
+  uint8_t  setsLoaded;            // blink/PWM sets known to hold the defaults (or _pwm)
+};
+
+// grayscale of a beam, allocated with the first setLevels()
+struct BeamPwm {
+  uint8_t  level[BEAM_PWM_SETS][BEAM_PWM_BYTES];  // PWM bytes as they are meant to be on the chip
+  uint32_t dirty[BEAM_PWM_SETS][5];               // bytes of level[] not yet written
+  uint8_t  custom;                                // sets holding level[] instead of full brightness
+  uint8_t  queued;                                // sets with a flush already in the queue
+};
+
+// where a beam of the chain is found
+struct BeamPort {
+  TwoWire *wire;
+  uint8_t  bus;                   // index of wire in the buses of the chain
+  uint8_t  channel;               // mux channel or BEAM_NO_CHANNEL
+  uint8_t  addr;
+};
+
+// clock state of one bus of the chain
+struct BeamClock {
+  TwoWire *wire;
+  uint8_t  level;                 // BEAM_CLOCK the bus runs at
+  uint8_t  maxLevel;              // requested BEAM_CLOCK, never exceeded
+  uint16_t window;                // transactions in the current window
+  uint16_t errors;                // failed ones among them
+  uint32_t cleanSince;            // millis() of the last failure or step
+};
+
+// one queued bus operation of the async engine
+struct BeamOp {
+  uint8_t type;
+  uint8_t beam;
+  uint8_t reg;
+  uint8_t data;
+};
+
+// bus statistics of one beam of the chain
+struct BeamBusStats {
+  uint32_t transactions;
+  uint32_t bytes;                 // incl. address bytes
+  uint32_t nacks;
+  uint32_t busResets;             // bus resets after failures on this beam
+  uint32_t readTimeouts;
+  uint32_t offline;               // times the beam was taken offline
+};
+
+// duration of the calls of one kind of public operation (BEAM_JOB)
+struct BeamLatency {
+  uint32_t count;
+  uint32_t totalMicros;
+  uint32_t maxMicros;
+  uint32_t bucket[BEAM_LATENCY_BUCKETS];
+};
+
+class Beam;
+class BeamSync;
+typedef void (*BeamCallback)(Beam &beam, uint8_t job, bool ok);
+
 class Beam {
 public:
   Beam(int rstpin, int irqpin, int numberOfBeams);
   Beam(int rstpin, int irqpin, uint8_t syncMode, uint8_t beamAddress);
+  ~Beam();
   bool begin(TwoWire& wire = Wire);
+  bool begin(TwoWire& wire, BEAM_CLOCK clock, bool adaptive = false);
+  bool begin(TwoWire& wire, TwoWire& wire1, uint8_t beamsOnWire);
+  bool begin(TwoWire& wire, uint8_t muxAddress, uint8_t beamsPerChannel = BEAM_PER_BUS);
   void initBeam();
   void print(const char* text);
+  void print(const BeamImage &image);
   void printFrame(uint8_t frameToPrint, const char * text);
+  void printStream(const char* text);
+  bool updateStream();
+  void stopStream();
   void play();
   void display();
+  void present(BeamCanvas &canvas);
+  void setGamma(float gamma);
+  void setLevels(uint8_t set, const uint8_t *levels, uint16_t width);
+  void bindFrame(uint8_t frame, uint8_t set);
+  void playAnimation(BeamAnimation &animation);
+  bool updateAnimation();
+  void stopAnimation();
+  bool loadBank(const uint8_t *columns, uint8_t frames, uint8_t width = 1);
+  bool updateBanks();
+  void stopBanks();
+  void scrollText(const char *text, uint8_t fps = 30, bool loop = true);
+  bool updateScroll();
+  void stopScroll();
+  uint32_t droppedSteps();
   void draw();
   void setScroll(uint8_t direction, uint8_t fade);
   void setSpeed(uint8_t speed);
   void setLoops(uint8_t loops);
   void setMode(uint8_t mode);
+  void setUpdateMode(uint8_t mode);
+  void setAsync(uint8_t mode, unsigned int period = 5);
+  bool pump(uint32_t budget = 0);
+  uint16_t pending();
+  void onDone(BeamCallback callback);
+  void setHandoff(uint8_t mode);
+  void setRenderCache(size_t bytes);
+  const BeamRenderCache *renderCache();
+  const BeamBusStats *busStats(uint8_t beam);
+  const BeamLatency *latency(uint8_t job);
+  void clearStats();
+  void setBusClock(BEAM_CLOCK clock, bool adaptive = false);
+  uint32_t busClock(uint8_t bus = 0);
+  void setBusTimeouts(uint16_t readTimeout, uint8_t retries = BEAM_RETRIES,
+                      uint16_t backoff = BEAM_BACKOFF, uint8_t offlineAfter = BEAM_OFFLINE_AFTER);
+  bool isOnline(uint8_t beam);
+  bool exportStats(const char *name = "beamStats");
   volatile int beamNumber;
   int checkStatus();
   int status();
 
+  // for BeamSync, which keeps units of a single beam in step
+  uint8_t beamCount();
+  bool setSync(BeamSync *sync);
+  uint8_t syncMode();
+  void setSyncMode(uint8_t mode);
+  void movieFrames(uint8_t &first, uint8_t &length);
+  bool writeCtrlNow(uint8_t reg, uint8_t data, bool wait = true);
+  unsigned int setSyncTimer();
+
 private:
-  const uint8_t *BEAM;
-  uint16_t cs[12];
-  uint16_t segmentmask[8];
-  uint8_t  cscolumn[25];
+  BeamPort _port[MAXBEAMS];
   uint8_t  activeBeams;
   uint8_t  _gblMode;
   uint8_t  _syncMode;
@@ -99,19 +356,147 @@ private:
   uint8_t  _beamMode;
   uint8_t  _numLoops;
   uint8_t  _beamCount;
+  uint8_t  _updateMode;
+  bool     _initialized;        // chips set up by initBeam() since the last reset
+  uint8_t  _regsel[MAXBEAMS];   // currently selected RAM section per beam (0 = unknown)
   int      _rst;
   int      _irq;
-  TwoWire *_wire;
-  Timer   *_syncTimer;
+  uint8_t  _buses;             // buses the chain is spread over
+  BeamPwm *_pwm;                // one per beam, allocated by setLevels()
+  uint8_t *_gammaLut;           // 256 entries, NULL = linear
+  uint8_t  _frameSet[MAXFRAME]; // PWM set each frame is bound to
+  BeamAnimation *_animation;    // played by updateAnimation()
+  uint8_t  _animationFrame;     // picture frame (0 or 1) on display
+  uint32_t _animationDue;       // millis() when the next frame is due
+  uint8_t  _bank;               // bank on display, BEAM_NO_BANK = bank mode off
+  uint8_t  _bankNext;           // bank loaded to switch to, BEAM_NO_BANK = none
+  uint8_t  _bankFrames[2];      // frames held by bank A and B
+  uint16_t _bankWaiting;        // beams still to switch to _bankNext, one bit each
+  uint32_t _bankPoll;
+  char    *_scrollText;         // copy of the text scrollText() moves across the chain
+  BeamCanvas *_scrollCanvas;    // what the chain shows of it, allocated by scrollText()
+  uint32_t _scrollPos;          // next character of the text to move in
+  const uint8_t *_scrollGlyph;  // rest of the character moving in
+  uint16_t _scrollTail;         // blank columns moved in after the text
+  bool     _scrollLoop;
+  uint16_t _scrollFrames;       // picture frame (0 or 1) on display, one bit per beam
+  uint32_t _scrollPeriod;       // us per step
+  uint32_t _scrollDue;          // micros() when the next step is due
+  uint32_t _scrollDropped;      // steps skipped since scrollText()
+  const BeamCanvas *_canvas;    // canvas frame 0 shows, NULL once other content got written
+  uint8_t  _muxAddress;         // 0 without a mux
+  uint8_t  _muxChannel;         // channel the mux has switched to, BEAM_NO_CHANNEL = unknown
+  uint8_t  _clockMode;          // BEAM_CLOCK requested by begin() or setBusClock()
+  bool     _adaptiveClock;
+  BeamClock _clock[BEAM_BUSES];
+  uint16_t _readTimeout;        // ms
+  uint8_t  _retries;
+  uint16_t _backoff;            // us
+  uint8_t  _offlineAfter;
+  uint8_t  _failures[MAXBEAMS]; // failed transactions in a row per beam
+  bool     _offline[MAXBEAMS];  // beams skipped on the bus until a probe finds them
+  bool     _stale[MAXBEAMS];    // beams that missed a write, replayed from the shadow
+  uint32_t _probeAt[MAXBEAMS];  // millis() of the next probe of an offline beam
+  BeamSync *_sync;              // keeps this unit in step with others, see BeamSync
+  BeamShadow *_shadow;          // one per beam, allocated in begin()
+  uint8_t  _asyncMode;
+  BeamOp  *_queue;              // ring buffer, allocated by setAsync()
+  uint16_t _queueHead;
+  uint16_t _queueTail;
+  uint64_t _frameQueued[MAXBEAMS];  // frames with a flush already in the queue
+  bool     _executing;          // inside execute(), run nested ops right away
+  uint8_t  _opPhase;            // progress of a multi-step op (reset, play)
+  uint32_t _opStart;
+  uint16_t _jobErrors;
+  BeamCallback _doneCallback;
+  Timer   *_pumpTimer;
+  uint32_t _pumpBudget;
+  RecursiveMutex _lock;
+  uint8_t  _handoffMode;
+  bool     _handoffBusy;        // play() waits for beams of the chain to be started
+  volatile bool _irqPending;    // set by the IRQ pin ISR, handled by handleIrq()
+  Timer   *_irqTimer;
+  BeamRenderCache *_cache;
+  char    *_streamText;         // copy of the text printStream() is scrolling
+  BeamRenderer _streamRenderer;
+  uint8_t  _streamTail;         // blank frames appended after the text so far
+  uint32_t _streamNext;         // next text frame to render
+  uint32_t _streamFill[MAXBEAMS];   // next text frame to upload per beam
+  uint32_t _streamPos[MAXBEAMS];    // frames played so far per beam
+  uint8_t  _streamCursor[MAXBEAMS]; // frame on display at the last poll
+  uint32_t _streamPoll;
+  uint16_t _streamRing[BEAM_STREAM_RING][12];
+  BeamBusStats _busStats[MAXBEAMS];
+  BeamLatency  _latency[BEAM_JOBS];
+  uint8_t  _opDepth;            // public operations in progress, see BeamOpTimer
+  char    *_statsText;          // JSON summary behind the exported Particle.variable
+
+#if PLATFORM_THREADING
+  Thread  *_worker;             // flushes frames on the second bus
+  os_semaphore_t _workStart;
+  os_semaphore_t _workDone;
+  volatile bool  _workerQuit;
+#endif
+  uint64_t _workBatch[MAXBEAMS];    // frames handed to the worker
+  bool     _workerBusy;         // worker flushing the second bus, see flushFrames()
+  uint16_t _workErrors;         // failed transactions of the worker, added to _jobErrors
+
+  friend class BeamOpTimer;
 
   void startNextBeam();
+  uint8_t handoffFrame(uint8_t b);
+  uint8_t displayCurrent();
+  void resetBeams();
+  void init();
+  bool startBus();
+  bool handoffByTimer();
+  void submit(uint8_t type, uint8_t b, uint8_t reg = 0, uint8_t data = 0);
+  bool execute(const BeamOp &op);
+  bool stepReset();
+  bool stepPlay();
+  void finishJob(uint8_t job);
+  void onPumpTimer();
+  void onIrq();
+  void onIrqTimer();
+  void handleIrq();
+  void prepareUpdate();
+  void clearOtherFrames(const uint64_t *written);
+  void fillStream();
+  void armBank(uint8_t bank);
+  void switchBank(uint8_t b);
+  uint8_t nextScrollColumn();
+  void stopPlayback();
+  void flushQueuedFrames();
+  void flushFrames(const uint64_t *batch);
+  void flushBeam(uint8_t b, uint64_t frames);
+  void workerLoop();
+  void nextStreamFrame(uint16_t *words);
   void initializeBeam(uint8_t b);
+  void loadBlinkPwmSets(uint8_t b);
   void setPrintDefaults(uint8_t mode, uint8_t startFrame, uint8_t numFrames, uint8_t numLoops, uint8_t frameDelay, uint8_t scrollDir, uint8_t fadeMode);
-  void writeFrame(uint8_t addr, uint8_t f);
-  void convertFrame(const uint8_t * currentFrame);
-  unsigned int setSyncTimer();
-  void sendWriteCmd(uint8_t addr, uint8_t ramsection, uint8_t subreg, uint8_t subregdata);
-  uint8_t sendReadCmd(uint8_t addr, uint8_t ramsection, uint8_t subreg);
-  uint8_t i2cwrite(uint8_t address, uint8_t cmdbyte, uint8_t databyte);
+  void writeFrame(uint8_t b, uint8_t f, const uint16_t *words);
+  void flushFrame(uint8_t b, uint8_t f);
+  void flushPwm(uint8_t b, uint8_t set);
+  void writeCtrl(uint8_t b, uint8_t reg, uint8_t data);
+  void invalidateShadow();
+  void applySyncMode(uint8_t mode);
+  bool sendWriteCmd(uint8_t b, uint8_t ramsection, uint8_t subreg, uint8_t subregdata);
+  bool sendBurstCmd(uint8_t b, uint8_t ramsection, uint8_t subreg, const uint8_t *data, uint8_t len);
+  uint8_t sendReadCmd(uint8_t b, uint8_t ramsection, uint8_t subreg);
+  bool selectSection(uint8_t b, uint8_t ramsection);
+  TwoWire *bus(uint8_t b);
+  void writeFailed(uint8_t b);
+  void countError(uint8_t b);
+  uint8_t transmit(uint8_t b, uint8_t reg, const uint8_t *data, uint8_t len);
+  void probeOffline();
+  void recoverBeam(uint8_t b);
+  void resetBus(uint8_t b);
+  void countTransfer(uint8_t b, uint8_t len, uint8_t result);
+  void applyClock();
+  void setWireClock(uint8_t bus, uint8_t level);
+  void adaptClock(uint8_t b, bool failed);
+  void recordLatency(uint8_t job, uint32_t micros);
+  void updateStatsText();
+  uint8_t i2cwrite(uint8_t b, uint8_t cmdbyte, uint8_t databyte);
 };
 
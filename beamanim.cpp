@@ -0,0 +1,203 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+===========================================================================
+*/
+#include <string.h>
+#include <new>
+#include <Particle.h>
+#include "beamanim.h"
+#include "beamcanvas.h"
+
+BeamAnimation::BeamAnimation(const uint8_t *data, size_t length) {
+  _data = data;
+  _length = length;
+  _stream = NULL;
+  _columns = NULL;
+  rewind();
+}
+
+BeamAnimation::BeamAnimation(Stream &stream) {
+  _data = NULL;
+  _length = 0;
+  _stream = &stream;
+  _columns = NULL;
+  _pos = 0;
+  _headerFill = 0;
+}
+
+BeamAnimation::~BeamAnimation() {
+  delete[] _columns;
+}
+
+bool BeamAnimation::begin() {
+  if (_columns) return true;
+
+  while (_headerFill < BEAM_ANIMATION_HEADER) {
+    int c = read();
+    if (c < 0) return false;
+    _header[_headerFill++] = c;
+  }
+  if (_header[0] != 'B' || _header[1] != 'M' || _header[2] != BEAM_ANIMATION_VERSION || !width()) {
+    Log.warn("Not a Beam animation (version %d)", BEAM_ANIMATION_VERSION);
+    return false;
+  }
+
+  _columns = new (std::nothrow) uint8_t[BEAM_COLUMNS * width()];
+  if (!_columns) {
+    Log.warn("Not enough memory for a %d beam wide animation", width());
+    return false;
+  }
+  memset(_columns, 0x00, BEAM_COLUMNS * width());
+  _frame = 0;
+  _column = 0;
+  _time = -1;
+  _run = 0;
+  _literal = 0;
+  return true;
+}
+
+int BeamAnimation::nextFrame() {
+  // a header that is complete but no good ends the animation right away
+  if (!begin()) return (_headerFill == BEAM_ANIMATION_HEADER) ? -1 : starved();
+  if (_frame >= frames()) return -1;
+
+  if (_time < 0) {
+    int c = read();
+    if (c < 0) return starved();
+    _time = (c ? c : _header[6]) * 10;
+    if (!_time) _time = 1;
+  }
+
+  uint16_t total = BEAM_COLUMNS * width();
+  while (_column < total) {
+    if (_run) {
+      _column++;
+      _run--;
+      continue;
+    }
+
+    int c = read();
+    if (c < 0) return starved();
+    if (_literal) {
+      _columns[_column++] ^= c;
+      _literal--;
+    }
+    else if (c & 0x80) {
+      _run = (c & 0x7F) + 1;
+    }
+    else {
+      _literal = c + 1;
+    }
+  }
+
+  int time = _time;
+  _frame++;
+  _column = 0;
+  _time = -1;
+  return time;
+}
+
+bool BeamAnimation::rewind() {
+  if (_stream) return false;
+
+  _pos = 0;
+  _headerFill = 0;
+  delete[] _columns;
+  _columns = NULL;
+  return true;
+}
+
+const uint8_t *BeamAnimation::columns() const {
+  return _columns;
+}
+
+uint8_t BeamAnimation::width() const {
+  return _headerFill == BEAM_ANIMATION_HEADER ? _header[3] : 0;
+}
+
+uint16_t BeamAnimation::frames() const {
+  return _headerFill == BEAM_ANIMATION_HEADER ? _header[4] | _header[5] << 8 : 0;
+}
+
+bool BeamAnimation::loop() const {
+  return _columns && (_header[7] & BEAM_ANIMATION_LOOP);
+}
+
+/*
+Next byte of the animation, -1 when none is available (yet)
+*/
+int BeamAnimation::read() {
+  if (_stream) return _stream->available() > 0 ? _stream->read() : -1;
+  return _pos < _length ? _data[_pos++] : -1;
+}
+
+/*
+What nextFrame() returns when the input runs out: a stream may get more
+bytes, but data in memory was cut short and is no good
+*/
+int BeamAnimation::starved() const {
+  return _stream ? 0 : -1;
+}
+
+/*
+Writes one token of changed (n XORed bytes) or unchanged columns
+*/
+static bool putToken(uint8_t *&out, const uint8_t *end, bool changed, const uint8_t *delta, int n) {
+  if (end - out < 1 + (changed ? n : 0)) return false;
+  *out++ = (changed ? 0x00 : 0x80) | (n - 1);
+  if (changed) {
+    memcpy(out, delta, n);
+    out += n;
+  }
+  return true;
+}
+
+size_t beamEncodeAnimation(const uint8_t *columns, uint16_t frames, uint8_t width,
+                           const uint8_t *times, uint8_t time, uint8_t flags,
+                           uint8_t *out, size_t size) {
+  uint8_t *start = out;
+  const uint8_t *end = out + size;
+  int total = BEAM_COLUMNS * width;
+
+  if (size < BEAM_ANIMATION_HEADER) return 0;
+  *out++ = 'B';
+  *out++ = 'M';
+  *out++ = BEAM_ANIMATION_VERSION;
+  *out++ = width;
+  *out++ = frames & 0xFF;
+  *out++ = frames >> 8;
+  *out++ = time;
+  *out++ = flags;
+
+  uint8_t delta[128];
+  for (int f = 0; f < frames; f++) {
+    const uint8_t *frame = &columns[f * total];
+    const uint8_t *prev = f ? &columns[(f - 1) * total] : NULL;
+
+    if (out >= end) return 0;
+    *out++ = times ? times[f] : 0;
+
+    // runs of unchanged and changed columns, at most 128 each
+    int n = 0;
+    bool changed = false;
+    for (int x = 0; x < total; x++) {
+      uint8_t d = frame[x] ^ (prev ? prev[x] : 0);
+      if (n && ((d != 0) != changed || n == 128)) {
+        if (!putToken(out, end, changed, delta, n)) return 0;
+        n = 0;
+      }
+      changed = (d != 0);
+      delta[n++] = d;
+    }
+    if (n && !putToken(out, end, changed, delta, n)) return 0;
+  }
+  return out - start;
+}
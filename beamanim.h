@@ -0,0 +1,97 @@
+﻿#pragma once
+/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Compact animations of any length. Frames are stored as the XOR of their
+columns (bit r = row r, like the character map) with those of the frame
+before, run length coded, each with its own frame time:
+
+  header, 8 bytes
+    0  'B' 'M'      magic
+    2  version      BEAM_ANIMATION_VERSION
+    3  width        frame width in beams, 24 columns each
+    4  frames       number of frames, 16 bit little endian
+    6  time         default frame time in 10 ms
+    7  flags        BEAM_ANIMATION_LOOP
+  every frame
+    0  time         frame time in 10 ms, 0 = default
+    1  ...          tokens until all columns are decoded:
+                      0x80 | n   n + 1 columns unchanged
+                      n          n + 1 XORed column bytes follow
+
+BeamAnimation decodes one frame at a time from memory (flash or RAM) or
+from a Stream, which does not need to have all bytes available yet:
+
+  BeamAnimation animation(data, sizeof(data));
+  b.playAnimation(animation);
+  ...
+  b.updateAnimation();        // in loop()
+
+===========================================================================
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#define BEAM_ANIMATION_VERSION 1
+#define BEAM_ANIMATION_HEADER  8
+#define BEAM_ANIMATION_LOOP    0x01
+
+class Stream;
+
+class BeamAnimation {
+public:
+  BeamAnimation(const uint8_t *data, size_t length);
+  BeamAnimation(Stream &stream);
+  ~BeamAnimation();
+
+  // reads the header, false while it is not (yet) available or invalid
+  bool begin();
+  // decodes the next frame, returns its time in ms, 0 while a stream has
+  // no more bytes yet and -1 at the end of the animation or when it is no
+  // good (e.g. data in memory that ends within a frame)
+  int nextFrame();
+  // starts over, memory sources only
+  bool rewind();
+
+  const uint8_t *columns() const;
+  uint8_t  width() const;       // in beams
+  uint16_t frames() const;
+  bool loop() const;
+
+private:
+  const uint8_t *_data;
+  size_t   _length;
+  size_t   _pos;
+  Stream  *_stream;
+
+  uint8_t  _header[BEAM_ANIMATION_HEADER];
+  uint8_t  _headerFill;
+  uint8_t *_columns;            // decoded frame, 24 * width bytes
+  uint16_t _frame;              // frames decoded
+  uint16_t _column;             // position in the frame being decoded
+  int      _time;               // frame time of it, -1 = not read yet
+  uint8_t  _run;                // unchanged columns left of the current token
+  uint8_t  _literal;            // XORed bytes left of the current token
+
+  int read();
+  int starved() const;
+
+  BeamAnimation(const BeamAnimation &);
+  BeamAnimation &operator=(const BeamAnimation &);
+};
+
+// writes frames (24 * width column bytes each) as an animation to out,
+// times[] in 10 ms or NULL for the default time; returns the bytes written,
+// 0 when out is too small
+size_t beamEncodeAnimation(const uint8_t *columns, uint16_t frames, uint8_t width,
+                           const uint8_t *times, uint8_t time, uint8_t flags,
+                           uint8_t *out, size_t size);
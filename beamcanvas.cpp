@@ -0,0 +1,119 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+===========================================================================
+*/
+#include <string.h>
+#include <new>
+#include "beamcanvas.h"
+#include "beamrender.h"
+
+BeamCanvas::BeamCanvas(uint8_t beams) {
+  _beams = beams;
+  _back = new (std::nothrow) uint8_t[2 * BEAM_COLUMNS * beams];
+  _front = _back ? _back + BEAM_COLUMNS * beams : NULL;
+  if (!_back) _beams = 0;
+  if (_back) memset(_back, 0x00, 2 * BEAM_COLUMNS * beams);
+}
+
+BeamCanvas::~BeamCanvas() {
+  delete[] _back;
+}
+
+uint8_t BeamCanvas::beams() const {
+  return _beams;
+}
+
+uint16_t BeamCanvas::width() const {
+  return BEAM_COLUMNS * _beams;
+}
+
+uint8_t BeamCanvas::height() const {
+  return BEAM_ROWS;
+}
+
+void BeamCanvas::clear() {
+  if (_back) memset(_back, 0x00, width());
+}
+
+void BeamCanvas::setPixel(int x, int y, bool on) {
+  if (x < 0 || x >= width() || y < 0 || y >= BEAM_ROWS) return;
+  if (on) _back[x] |= 1 << y;
+  else _back[x] &= ~(1 << y);
+}
+
+bool BeamCanvas::getPixel(int x, int y) const {
+  if (x < 0 || x >= width() || y < 0 || y >= BEAM_ROWS) return false;
+  return (_back[x] >> y) & 1;
+}
+
+void BeamCanvas::hline(int x, int y, int w, bool on) {
+  for (int i = 0; i < w; i++) setPixel(x + i, y, on);
+}
+
+void BeamCanvas::vline(int x, int y, int h, bool on) {
+  for (int i = 0; i < h; i++) setPixel(x, y + i, on);
+}
+
+void BeamCanvas::blit(int x, int y, const uint8_t *columns, int w) {
+  if (y <= -BEAM_ROWS || y >= BEAM_ROWS) return;
+  uint8_t mask = (y >= 0) ? (0x1F << y) & 0x1F : 0x1F >> -y;
+
+  for (int i = 0; i < w; i++) {
+    if (x + i < 0 || x + i >= width()) continue;
+    uint8_t column = (y >= 0) ? columns[i] << y : columns[i] >> -y;
+    _back[x + i] = (_back[x + i] & ~mask) | (column & mask);
+  }
+}
+
+int BeamCanvas::glyph(int x, uint8_t c) {
+  const uint8_t *columns = beamGlyph(c);
+  int w = 0;
+  while (columns[w] != 0xFF) w++;
+  blit(x, 0, columns, w);
+  return x + w;
+}
+
+int BeamCanvas::text(int x, const char *text) {
+  for (; *text; text++) {
+    if ((uint8_t)*text == 0xC3) continue;   // two byte character prefix, see beamGlyph()
+    x = glyph(x, *text);
+  }
+  return x;
+}
+
+void BeamCanvas::scroll(int dx) {
+  int w = width();
+  if (dx >= w || dx <= -w) {
+    clear();
+    return;
+  }
+  if (dx > 0) {
+    memmove(_back, _back + dx, w - dx);
+    memset(_back + w - dx, 0x00, dx);
+  }
+  else if (dx < 0) {
+    memmove(_back - dx, _back, w + dx);
+    memset(_back, 0x00, -dx);
+  }
+}
+
+const uint8_t *BeamCanvas::columns(uint8_t beam) const {
+  return &_back[beam * BEAM_COLUMNS];
+}
+
+bool BeamCanvas::changed(uint8_t beam) const {
+  if (beam >= _beams) return false;
+  return memcmp(&_back[beam * BEAM_COLUMNS], &_front[beam * BEAM_COLUMNS], BEAM_COLUMNS) != 0;
+}
+
+void BeamCanvas::flip() {
+  if (_back) memcpy(_front, _back, width());
+}
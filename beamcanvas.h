@@ -0,0 +1,66 @@
+﻿#pragma once
+/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Pixel framebuffer spanning a chain of beams, 24 x 5 pixels per beam with
+x = 0 the leftmost column of BEAMA. Drawing goes to the back buffer, the
+front buffer holds what Beam::present() uploaded last, so present() only
+has to pack and send the beams whose columns changed:
+
+  BeamCanvas canvas(3);
+  canvas.hline(0, 4, level, true);      // bar of level pixels in the bottom row
+  b.present(canvas);
+
+===========================================================================
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#define BEAM_COLUMNS 24
+#define BEAM_ROWS     5
+
+class BeamCanvas {
+public:
+  BeamCanvas(uint8_t beams = 1);
+  ~BeamCanvas();
+
+  uint8_t  beams() const;
+  uint16_t width() const;
+  uint8_t  height() const;
+
+  void clear();
+  void setPixel(int x, int y, bool on = true);
+  bool getPixel(int x, int y) const;
+  void hline(int x, int y, int w, bool on = true);
+  void vline(int x, int y, int h, bool on = true);
+  // copies w columns (bit r = row r, like the character map) to x, moved down by y rows
+  void blit(int x, int y, const uint8_t *columns, int w);
+  // draws a character or text at column x, returns the column after it
+  int glyph(int x, uint8_t c);
+  int text(int x, const char *text);
+  // moves everything dx columns to the left (right for dx < 0), blank columns move in
+  void scroll(int dx);
+
+  // back buffer columns of a beam and whether they differ from the front buffer
+  const uint8_t *columns(uint8_t beam) const;
+  bool changed(uint8_t beam) const;
+  // back buffer becomes the front buffer, called by Beam::present()
+  void flip();
+
+private:
+  uint8_t *_back;
+  uint8_t *_front;
+  uint8_t  _beams;
+
+  BeamCanvas(const BeamCanvas &);
+  BeamCanvas &operator=(const BeamCanvas &);
+};
@@ -0,0 +1,224 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+===========================================================================
+*/
+#include <ctype.h>
+#include <string.h>
+#include <new>
+#include "beamrender.h"
+#include "charactermap.h"
+
+/*
+Returns the columns of the glyph for character c, terminated by 0xFF.
+Special characters (e.g. German Umlauts) arrive as the second byte of their
+two byte UTF-8 sequence, the 0xC3 prefix has to be skipped by the caller.
+*/
+const uint8_t *beamGlyph(uint8_t c) {
+  int asciiVal = toupper(c);
+  if (32 <= asciiVal && asciiVal <= 96) {
+    return &charactermap[(asciiVal - 32)][0];
+  }
+
+  switch (c) {
+    case 0x84: // (0xC3 0x84) 'Ä'
+    case 0xA4: // (0xC3 0xA4) 'ä'
+      return &charactermap[65][0];
+    case 0x96: // (0xC3 0x96) 'Ö'
+    case 0xB6: // (0xC3 0x86) 'ö'
+      return &charactermap[66][0];
+    case 0x9C: // (0xC3 0x9C) 'Ü'
+    case 0xBC: // (0xC3 0xBC) 'ü'
+      return &charactermap[67][0];
+    case 0x9F: // (0xC3 0xDF) 'ß'
+      return &charactermap[68][0];
+    default:
+      return &charactermap[0][0];
+  }
+}
+
+/*
+Packs 24 columns (5 bits each) into 12 CS words, two columns per word
+*/
+void beamPackColumns(const uint8_t *columns, uint16_t *cs) {
+  for (int j = 0; j < 12; j++) {
+    cs[j] = (columns[j * 2]) | (columns[j * 2 + 1] << 5);
+  }
+}
+
+/*
+Converts a bitmap generated at runtime from the frameList layout into 12 CS
+words. Each pair of adjacent pixels in a row maps to one table entry.
+*/
+void beamConvertFrame(const uint8_t *rows, uint16_t *cs) {
+  static const uint16_t pairBits[4] = { 0x0000, 0x0020, 0x0001, 0x0021 };
+
+  memset(cs, 0x00, 12 * sizeof(uint16_t));
+  for (int r = 0; r < 5; r++) {
+    for (int k = 0; k < 12; k++) {
+      cs[k] |= pairBits[(rows[r * 3 + k / 4] >> (6 - (k % 4) * 2)) & 0x03] << r;
+    }
+  }
+}
+
+BeamRenderer::BeamRenderer(const char *text) {
+  _text = text;
+  _pos = 0;
+  _len = strlen(text);
+  _glyph = NULL;
+  _done = (_len == 0);
+}
+
+bool BeamRenderer::done() const {
+  return _done;
+}
+
+/*
+Lays out the next frame into cs[12]. Returns false once the text is used up.
+full tells whether the frame is filled up to its last column; the frame
+after the last full one is the partly filled end of the text.
+*/
+bool BeamRenderer::nextFrame(uint16_t *cs, bool *full) {
+  if (_done) return false;
+
+  uint8_t cscolumn[24];
+  int cscount = 0;
+  memset(cscolumn, 0x00, sizeof(cscolumn));
+
+  //special case if a character needs to wrap to next frame
+  while (_glyph && cscount < 24 && *_glyph != 0xFF) {
+    cscolumn[cscount++] = *_glyph++;
+  }
+  _glyph = NULL;
+
+  while (_pos < _len) {
+    // pick a character to print to Beam
+    uint8_t c = _text[_pos++];
+    if (c == 0xC3) continue;   // two byte character prefix to be ignored
+
+    // loop through the Beam grid and place characters
+    // from the character map
+    const uint8_t *fontptr = beamGlyph(c);
+    while (cscount < 24 && *fontptr != 0xFF) {
+      cscolumn[cscount++] = *fontptr++;
+    }
+
+    if (cscount > 23) {
+      // end of grid is reached in current frame
+      if (*fontptr != 0xFF) _glyph = fontptr;
+      beamPackColumns(cscolumn, cs);
+      if (full) *full = true;
+      return true;
+    }
+  }
+
+  // end of string is reached in current frame
+  beamPackColumns(cscolumn, cs);
+  if (full) *full = false;
+  _done = true;
+  return true;
+}
+
+/*
+Lays out the whole text into image, at most maxFrames full frames.
+Returns the number of frames used.
+*/
+uint8_t beamRender(const char *text, BeamImage &image, uint8_t maxFrames) {
+  BeamRenderer renderer(text);
+  bool full = false;
+
+  if (maxFrames > MAXFRAME) maxFrames = MAXFRAME;
+  image.frames = 0;
+  image.fullFrames = 0;
+
+  while (image.fullFrames < maxFrames && image.frames < MAXFRAME
+         && renderer.nextFrame(image.cs[image.frames], &full)) {
+    image.frames++;
+    if (full) image.fullFrames = image.frames;
+  }
+  return image.frames;
+}
+
+/*
+bytes limits the memory taken by the cached images (one image is roughly
+900 bytes), at most 255 entries
+*/
+BeamRenderCache::BeamRenderCache(size_t bytes) {
+  size_t entries = bytes / sizeof(Entry);
+  if (entries > 255) entries = 255;
+
+  _entries = entries ? new (std::nothrow) Entry[entries] : NULL;
+  _capacity = _entries ? entries : 0;
+  _hits = 0;
+  _misses = 0;
+  clear();
+}
+
+BeamRenderCache::~BeamRenderCache() {
+  delete[] _entries;
+}
+
+/*
+Returns the image for text, rendering it only if it is not cached yet.
+The image stays valid until the next call. Texts of BEAM_CACHE_TEXT
+characters and more are not cached.
+*/
+const BeamImage *BeamRenderCache::render(const char *text, uint8_t maxFrames) {
+  uint32_t key = 2166136261UL;
+  size_t length = 0;
+  for (const char *c = text; *c; c++, length++) {
+    key = (key ^ (uint8_t)*c) * 16777619UL;
+  }
+  key = (key ^ maxFrames) * 16777619UL;
+
+  Entry *victim = NULL;
+  for (int e = 0; e < _capacity; e++) {
+    Entry &entry = _entries[e];
+    if (entry.used && entry.key == key && entry.length == length && !strcmp(entry.text, text)) {
+      entry.used = ++_clock;
+      _hits++;
+      return &entry.image;
+    }
+    if (!victim || entry.used < victim->used) victim = &entry;
+  }
+
+  _misses++;
+  if (!victim || length >= BEAM_CACHE_TEXT) {
+    // no room at all or too long to keep, render into the scratch image
+    beamRender(text, _scratch, maxFrames);
+    return &_scratch;
+  }
+
+  victim->key = key;
+  victim->length = length;
+  victim->used = ++_clock;
+  memcpy(victim->text, text, length + 1);
+  beamRender(text, victim->image, maxFrames);
+  return &victim->image;
+}
+
+void BeamRenderCache::clear() {
+  _clock = 0;
+  for (int e = 0; e < _capacity; e++) {
+    _entries[e].used = 0;
+  }
+}
+
+uint8_t BeamRenderCache::capacity() const {
+  return _capacity;
+}
+
+uint32_t BeamRenderCache::hits() const {
+  return _hits;
+}
+
+uint32_t BeamRenderCache::misses() const {
+  return _misses;
+}
@@ -0,0 +1,117 @@
+﻿#pragma once
+/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Render stage: lays out text into frames of CS words without touching the
+bus, so messages can be rendered ahead of time, reused for every beam and
+run on a host without hardware.
+
+===========================================================================
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef MAXFRAME
+#define MAXFRAME 36
+#endif
+
+// longest text a BeamRenderCache entry keeps (longer ones are rendered every time)
+#ifndef BEAM_CACHE_TEXT
+#define BEAM_CACHE_TEXT 64
+#endif
+
+// text laid out into frames, each frame as the 12 CS words of the chip
+struct BeamImage {
+  uint16_t cs[MAXFRAME][12];
+  uint8_t  frames;        // frames holding text (incl. a last, partly filled one)
+  uint8_t  fullFrames;    // frames filled up to the last column
+};
+
+// lays out text one 24 column frame at a time
+class BeamRenderer {
+public:
+  BeamRenderer(const char *text = "");
+  bool nextFrame(uint16_t *cs, bool *full = 0);
+  bool done() const;
+
+private:
+  const char    *_text;
+  int            _pos;
+  int            _len;
+  const uint8_t *_glyph;  // rest of a character that did not fit the last frame
+  bool           _done;
+};
+
+// keeps the images of the most recently rendered texts, so repeated messages
+// skip the layout entirely (least recently used entries are dropped first)
+class BeamRenderCache {
+public:
+  BeamRenderCache(size_t bytes);
+  ~BeamRenderCache();
+  const BeamImage *render(const char *text, uint8_t maxFrames = MAXFRAME);
+  void clear();
+  uint8_t  capacity() const;
+  uint32_t hits() const;
+  uint32_t misses() const;
+
+private:
+  struct Entry {
+    uint32_t  key;          // FNV-1a hash of text and render parameters
+    uint16_t  length;       // text length
+    uint32_t  used;         // _clock at last use, 0 = empty
+    char      text[BEAM_CACHE_TEXT];  // compared on a hit, the hash may collide
+    BeamImage image;
+  };
+
+  Entry   *_entries;
+  BeamImage _scratch;     // texts that get no entry, each cache its own
+  uint8_t  _capacity;
+  uint32_t _clock;
+  uint32_t _hits;
+  uint32_t _misses;
+
+  BeamRenderCache(const BeamRenderCache &);
+  BeamRenderCache &operator=(const BeamRenderCache &);
+};
+
+// bitmaps in the frameList layout of frames.h (5 rows of 3 bytes, MSB is the
+// leftmost column) converted to CS words: word k holds columns 2k and 2k + 1
+struct BeamFrames {
+  uint16_t cs[MAXFRAME][12];
+};
+
+constexpr uint16_t beamFrameWord(const uint8_t (&rows)[15], int k) {
+  uint16_t word = 0;
+  for (int r = 0; r < 5; r++) {
+    uint8_t pair = rows[r * 3 + k / 4] >> (6 - (k % 4) * 2);
+    word |= ((pair >> 1) & 1) << r;
+    word |= (pair & 1) << (5 + r);
+  }
+  return word;
+}
+
+// done by the compiler for bitmaps known at compile time, e.g.
+//   static constexpr BeamFrames frames = beamConvertFrames(frameList);
+constexpr BeamFrames beamConvertFrames(const uint8_t (&rows)[MAXFRAME][15]) {
+  BeamFrames frames = {};
+  for (int f = 0; f < MAXFRAME; f++) {
+    for (int k = 0; k < 12; k++) {
+      frames.cs[f][k] = beamFrameWord(rows[f], k);
+    }
+  }
+  return frames;
+}
+
+const uint8_t *beamGlyph(uint8_t c);
+void beamPackColumns(const uint8_t *columns, uint16_t *cs);
+void beamConvertFrame(const uint8_t *rows, uint16_t *cs);
+uint8_t beamRender(const char *text, BeamImage &image, uint8_t maxFrames = MAXFRAME);
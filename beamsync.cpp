@@ -0,0 +1,224 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+===========================================================================
+*/
+#include <Particle.h>
+#include "beamsync.h"
+
+static uint8_t commonDivisor(uint8_t a, uint8_t b) {
+  while (b) {
+    uint8_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+BeamSync::BeamSync(uint8_t mode) {
+  _mode = (mode == SYNC_CLOCK) ? SYNC_CLOCK : SYNC_TIMER;
+  _count = 0;
+  _running = false;
+  _timer = NULL;
+  _step = 0;
+  _checkAt = 0;
+  _mismatch = 0;
+  _realign = false;
+  _realignments = 0;
+}
+
+BeamSync::~BeamSync() {
+  stop();
+  delete _timer;
+  for (int i = 0; i < _count; i++) {
+    _units[i].beam->setSync(NULL);
+  }
+}
+
+bool BeamSync::add(Beam &unit) {
+  BEAM_TRACE_CALL("bool BeamSync::add(Beam &unit)");
+  if (unit.beamCount() != 1) {
+    Log.warn("BeamSync takes units of a single beam, a chain stays in step by itself");
+    return false;
+  }
+  if (_running || _count >= MAXBEAMS || !unit.setSync(this)) {
+    Log.warn("Add units to a BeamSync before start(), to one of them only");
+    return false;
+  }
+
+  Unit &u = _units[_count++];
+  u.beam = &unit;
+  u.first = 0;
+  u.length = 1;
+  u.syncMode = unit.syncMode();
+  return true;
+}
+
+/*
+Takes unit out, the others stop running in step until the next start()
+*/
+void BeamSync::remove(Beam &unit) {
+  BEAM_TRACE_CALL("void BeamSync::remove(Beam &unit)");
+  stop();
+  for (int i = 0; i < _count; i++) {
+    if (_units[i].beam != &unit) continue;
+    unit.setSync(NULL);
+    _units[i] = _units[--_count];
+    return;
+  }
+}
+
+/*
+Takes the movie every unit is set up with and
+starts them all together at their first frame. With SYNC_TIMER the units
+show their frames as pictures, stepped by the timer at the frame time of
+the first unit; with SYNC_CLOCK the first unit drives the clock sync line.
+*/
+void BeamSync::start() {
+  BEAM_TRACE_CALL("void BeamSync::start()");
+  stop();
+  if (!_count) return;
+
+  for (int i = 0; i < _count; i++) {
+    Unit &unit = _units[i];
+    unit.beam->movieFrames(unit.first, unit.length);
+
+    if (_mode == SYNC_TIMER) {
+      // movie off, the timer steps the frames
+      unit.beam->writeCtrlNow(MOV, unit.first);
+      unit.beam->writeCtrlNow(PIC, 0 << 7 | 1 << 6 | unit.first);
+    }
+    else {
+      unit.beam->setSyncMode(i ? SYNC_SLAVE : SYNC_MASTER);
+    }
+  }
+
+  _step = 0;
+  _mismatch = 0;
+  _realign = false;
+  _checkAt = millis();
+  restart();
+  _running = true;
+
+  if (_mode == SYNC_TIMER) {
+    unsigned int period = _units[0].beam->setSyncTimer();
+    if (!_timer) _timer = new Timer(period, &BeamSync::onTimer, *this);
+    else _timer->changePeriod(period);
+    _timer->start();
+  }
+}
+
+void BeamSync::stop() {
+  BEAM_TRACE_CALL("void BeamSync::stop()");
+  if (_timer) _timer->stop();
+  if (!_running) return;
+  _running = false;
+
+  for (int i = 0; i < _count; i++) {
+    Unit &unit = _units[i];
+    if (_mode == SYNC_TIMER) {
+      unit.beam->writeCtrlNow(MOV, 0 << 7 | 1 << 6 | unit.first);
+    }
+    else {
+      unit.beam->setSyncMode(unit.syncMode);
+    }
+  }
+}
+
+/*
+With SYNC_CLOCK every BEAM_SYNC_CHECK ms reads the frame on display of
+all units. Should any be out of step twice in a row (a single check might
+fall on a frame boundary), all movies get restarted once the first unit
+shows the last frame of its loop. The timer keeps SYNC_TIMER in step by
+itself.
+*/
+bool BeamSync::update() {
+  if (!_running) return false;
+  if (_mode != SYNC_CLOCK || _count < 2) return true;
+
+  uint32_t interval = _realign ? 10 : BEAM_SYNC_CHECK;
+  if (millis() - _checkAt < interval) return true;
+  _checkAt = millis();
+
+  int reference = position(_units[0]);
+  if (reference == -1) return true;
+
+  if (_realign) {
+    if (reference == -2 || reference == _units[0].length - 1) {
+      Log.info("Re-aligning %d Beam units", _count);
+      restart();
+      _realign = false;
+      _realignments++;
+    }
+    return true;
+  }
+
+  // started together on one clock the units have played the same number of
+  // frames, whatever the length of their movies
+  bool inStep = (reference >= 0);
+  for (int i = 1; i < _count && inStep; i++) {
+    int pos = position(_units[i]);
+    if (pos == -1) continue;
+    uint8_t common = commonDivisor(_units[0].length, _units[i].length);
+    if (pos < 0 || pos % common != reference % common) inStep = false;
+  }
+
+  _mismatch = inStep ? 0 : _mismatch + 1;
+  if (_mismatch >= 2) {
+    _mismatch = 0;
+    _realign = true;
+  }
+  return true;
+}
+
+/*
+Times update() found the units out of step and restarted them
+*/
+uint32_t BeamSync::realignments() const {
+  return _realignments;
+}
+
+/*
+Shows the next frame on every unit. A unit the application is busy with
+is skipped and catches up with the next step, as the frame follows from
+the steps since start().
+*/
+void BeamSync::onTimer() {
+  _step++;
+  for (int i = 0; i < _count; i++) {
+    Unit &unit = _units[i];
+    unit.beam->writeCtrlNow(PIC, 0 << 7 | 1 << 6 | (unit.first + _step % unit.length), false);
+  }
+}
+
+/*
+Stops every unit and starts them again at their first frame, the ones
+following the clock sync line before the one driving it
+*/
+void BeamSync::restart() {
+  for (int i = 0; i < _count; i++) {
+    _units[i].beam->writeCtrlNow(SHDN, 0x02);
+  }
+  for (int i = _count - 1; i >= 0; i--) {
+    _units[i].beam->writeCtrlNow(SHDN, 0x03);
+  }
+}
+
+/*
+Position of the frame on display in the movie of unit, -1 if the unit is
+offline and -2 if it shows a frame outside of its movie
+*/
+int BeamSync::position(Unit &unit) {
+  if (!unit.beam->isOnline(0)) return -1;
+
+  int frame = unit.beam->status();
+  if (frame < unit.first || unit.first + unit.length <= frame) return -2;
+  return frame - unit.first;
+}
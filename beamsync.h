@@ -0,0 +1,90 @@
+﻿#pragma once
+/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Keeps the movies of beams set up as units of their own (see the Beam
+constructor taking a beam address) in step. Every AS1130 runs on its own
+oscillator, so without it the units drift apart within minutes.
+
+  SYNC_TIMER  one software timer steps all units through the frames of
+              their movies as pictures; a unit that misses a step catches
+              up with the next one
+  SYNC_CLOCK  the first unit drives the clock sync line, the others follow
+              it; update() restarts all movies together at the end of a
+              loop should a unit still get out of step
+
+  Beam left(RSTPIN, IRQPIN, SYNC_OFF, BEAMA);
+  Beam right(RSTPIN, IRQPIN, SYNC_OFF, BEAMB);
+  BeamSync sync(SYNC_TIMER);
+  ...
+  left.draw();
+  right.draw();
+  sync.add(left);
+  sync.add(right);
+  sync.start();               // again after new content
+  ...
+  sync.update();              // in loop()
+
+===========================================================================
+*/
+#include "beam.h"
+
+// ms between the checks of SYNC_CLOCK whether the units are still in step
+#define BEAM_SYNC_CHECK 1000
+
+enum BEAM_SYNC_ENGINE {
+  SYNC_TIMER = 0,
+  SYNC_CLOCK = 1,
+};
+
+class BeamSync {
+public:
+  BeamSync(uint8_t mode = SYNC_TIMER);
+  ~BeamSync();
+
+  // units of a single beam, each in one BeamSync at most
+  bool add(Beam &unit);
+  void remove(Beam &unit);
+  // starts the movies the units are set up with together at their first frame
+  void start();
+  // hands the units their own movies back
+  void stop();
+  // checks the units are in step and re-aligns them, false when not started
+  bool update();
+  uint32_t realignments() const;
+
+private:
+  struct Unit {
+    Beam    *beam;
+    uint8_t  first;             // movie frames
+    uint8_t  length;
+    uint8_t  syncMode;          // BEAM_SYNC the unit had before
+  };
+
+  Unit     _units[MAXBEAMS];
+  uint8_t  _count;
+  uint8_t  _mode;
+  bool     _running;
+  Timer   *_timer;
+  uint32_t _step;               // frames stepped by the timer since start()
+  uint32_t _checkAt;            // millis() of the last check
+  uint8_t  _mismatch;           // checks in a row that found units out of step
+  bool     _realign;            // restart at the end of the loop of the first unit
+  uint32_t _realignments;
+
+  void onTimer();
+  void restart();
+  int position(Unit &unit);
+
+  BeamSync(const BeamSync &);
+  BeamSync &operator=(const BeamSync &);
+};
@@ -0,0 +1,71 @@
+/*
+===========================================================================
+
+  This is an example for Beam.
+
+  Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+  Beam can be purchased here: http://www.hoverlabs.co
+
+  Written by Emran Mahbub and Jonathan Li for Hover Labs.
+  BSD license, all text above must be included in any redistribution
+
+#  INSTALLATION
+    The library files (beam.cpp/.h, beamrender.cpp/.h, beamcanvas.cpp/.h, beamanim.cpp/.h,
+    beamsync.cpp/.h, charactermap.h and frames.h) are required to run Beam.
+    Run the BeamAsync.ino file.
+
+#  SUPPORT
+    For questions and comments, email us at support@hoverlabs.co
+===========================================================================
+*/
+
+#include "application.h"
+#include "beam.h"
+
+/* pin definitions for Beam */
+#define RSTPIN 2        //use any digital pin
+#define IRQPIN 9        //currently not used
+#define BEAMCOUNT 1     //number of beams daisy chained together
+
+/* Iniitialize an instance of Beam */
+Beam b = Beam(RSTPIN, IRQPIN, BEAMCOUNT);
+
+unsigned long updateTimer = 0;
+int counter = 0;
+
+/* called once all transfers of a print(), play(), ... have been sent */
+void beamDone(Beam &beam, uint8_t job, bool ok) {
+    if (job == JOB_PRINT) {
+        Serial.printlnf("print done (%s)", ok ? "ok" : "failed");
+        beam.play();
+    }
+}
+
+void setup() {
+
+    Serial.begin(9600);
+    Wire.begin();
+
+    Serial.println("Starting Beam example");
+
+    /* queue bus traffic and send it from pump() in loop() */
+    b.setAsync(ASYNC_PUMP);
+    b.onDone(beamDone);
+    b.begin();
+
+}
+
+void loop() {
+
+    if (millis() - updateTimer > 10000) {
+        /* returns right away, the frames are sent by pump() */
+        b.print(String::format("COUNT %d", counter++));
+        updateTimer = millis();
+    }
+
+    /* spend at most 2ms per loop on the bus */
+    b.pump(2000);
+
+    // do something else here
+
+}
@@ -14,7 +14,8 @@
     v1.0  -  Initial Release
 
 #  INSTALLATION
-    The 4 library files (beam.cpp, beam.h and charactermap.h and frames.h) are required to run Beam.
+    The library files (beam.cpp/.h, beamrender.cpp/.h, beamcanvas.cpp/.h, beamanim.cpp/.h,
+    beamsync.cpp/.h, charactermap.h and frames.h) are required to run Beam.
     Run the BeamDemo.ino file.
     
 #  SUPPORT
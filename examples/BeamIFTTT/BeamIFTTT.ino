@@ -14,7 +14,8 @@
     v1.0  -  Initial Release
 
 #  INSTALLATION
-    The 4 library files (beam.cpp, beam.h and charactermap.h and frames.h) are required to run Beam.
+    The library files (beam.cpp/.h, beamrender.cpp/.h, beamcanvas.cpp/.h, beamanim.cpp/.h,
+    beamsync.cpp/.h, charactermap.h and frames.h) are required to run Beam.
     Run the BeamDemo.ino file.
     
 #  SUPPORT
@@ -46,13 +47,14 @@ void setup() {
     
     Particle.subscribe("Fitbit_Steps", fitbitHandler);
 
+    b.begin();
+
 }
 
     void fitbitHandler(const char *event, const char *data)
     {
        
        const char* stats = data;
-       b.begin();
        b.print(stats);
        b.setLoops(7);
        b.setSpeed(4);
@@ -10,7 +10,8 @@
   BSD license, all text above must be included in any redistribution
 
 #  INSTALLATION
-    The 4 library files (beam.cpp, beam.h and charactermap.h and frames.h) are required to run Beam.
+    The library files (beam.cpp/.h, beamrender.cpp/.h, beamcanvas.cpp/.h, beamanim.cpp/.h,
+    beamsync.cpp/.h, charactermap.h and frames.h) are required to run Beam.
     Run the BeamDemo.ino file.
 
 #  SUPPORT
@@ -95,7 +96,6 @@ void gotBusData(const char *name, const char *data) {
         char buf[1024];
         beamString.toCharArray(buf, 1024);
 
-        b.begin();
         b.print(buf);
         b.setSpeed(5);
         b.play();
@@ -20,7 +20,7 @@ Replaced "copy-paste" logic with functional blocks by use of arrays and loops
 ===========================================================================
 */ 
 
-const uint8_t frameList[MAXFRAME][15] = {
+constexpr uint8_t frameList[MAXFRAME][15] = {
 {                    //Frame 0
   0b00000000, 0b00000000, 0b00000000,     
   0b00000000, 0b00000000, 0b00000000,
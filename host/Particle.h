@@ -0,0 +1,279 @@
+﻿#pragma once
+/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Host stand-in for the parts of Particle.h the library uses, so it can be
+built and run on Linux together with the AS1130 model in as1130sim.h:
+
+  g++ -std=gnu++14 -funsigned-char -Wall -Wextra -Ihost -I. -o app app.cpp \
+      beam.cpp beamrender.cpp beamcanvas.cpp beamanim.cpp beamsync.cpp \
+      host/particle_host.cpp host/as1130sim.cpp
+
+Time is simulated: it only moves with delay(), bus transactions (by their
+modeled duration) and, by a microsecond, with every millis()/micros() call
+so busy-wait loops terminate. Timers fire from within delay().
+
+===========================================================================
+*/
+#if defined(PLATFORM_ID)
+// device build that picked up this directory, use the real header
+#include_next <Particle.h>
+#else
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <functional>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#define LOW           0
+#define HIGH          1
+#define INPUT         0
+#define OUTPUT        1
+#define INPUT_PULLUP  2
+#define CHANGE        1
+#define FALLING       2
+#define RISING        3
+
+#define I2C_BUFFER_LENGTH    32
+#define CLOCK_SPEED_100KHZ   100000
+#define CLOCK_SPEED_400KHZ   400000
+
+#define PLATFORM_THREADING         1
+#define CONCURRENT_WAIT_FOREVER    ((uint32_t)-1)
+
+#define ATOMIC_BLOCK()          for (int _atomic = 1; _atomic; _atomic = 0)
+#define SINGLE_THREADED_BLOCK() for (int _single = 1; _single; _single = 0)
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int  digitalRead(int pin);
+bool attachInterrupt(int pin, std::function<void()> handler, int mode);
+template <typename T>
+bool attachInterrupt(int pin, void (T::*handler)(), T *instance, int mode) {
+  return attachInterrupt(pin, [handler, instance]() { (instance->*handler)(); }, mode);
+}
+void detachInterrupt(int pin);
+
+// advances the simulated clock without running timers
+void hostAdvance(uint32_t us);
+// runs the interrupt handler attached to pin, as an edge on it would
+void hostInterrupt(int pin);
+
+// a device on the host I2C bus, see AS1130Sim
+class HostI2CDevice {
+public:
+  virtual ~HostI2CDevice() {}
+  virtual uint8_t address() const = 0;
+  virtual void write(const uint8_t *data, size_t len) = 0;
+  virtual uint8_t read() = 0;
+  virtual void pinChanged(int /* pin */, int /* level */) {}
+  virtual void tick(uint32_t /* now */) {}
+  // the device answering at address, a mux passes on to its channels
+  virtual HostI2CDevice *route(uint8_t address) { return address == this->address() ? this : NULL; }
+};
+
+// one transaction on the host bus
+struct HostBusRecord {
+  uint32_t at;            // micros() at the start
+  uint8_t  address;
+  bool     read;
+  bool     ack;           // false when no device answered
+  uint8_t  length;        // data bytes, without the address byte
+  uint8_t  data[I2C_BUFFER_LENGTH];
+  float    us100;         // modeled bus time at 100 kHz
+  float    us400;         // modeled bus time at 400 kHz
+};
+
+class TwoWire {
+public:
+  void begin();
+  void end();
+  bool isEnabled();
+  void setSpeed(uint32_t clock);
+  void reset();
+  bool lock();
+  void unlock();
+
+  void beginTransmission(uint8_t address);
+  void beginTransmission(int address);
+  size_t write(uint8_t data);
+  size_t write(const uint8_t *data, size_t len);
+  uint8_t endTransmission(uint8_t stop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t stop = true);
+  int available();
+  int read();
+
+  void attach(HostI2CDevice *device);
+  void detach(HostI2CDevice *device);
+  const std::vector<HostI2CDevice *> &devices() const;
+
+  // bus time of a transaction with len data bytes: start, address byte,
+  // data bytes (9 clocks each incl. ACK) and stop
+  static float busTime(size_t len, uint32_t clock);
+
+  // every transaction since the last clearRecords(), if recording is on
+  void setRecording(bool on);
+  const std::vector<HostBusRecord> &records() const;
+  void clearRecords();
+
+  uint32_t transactions;
+  uint32_t bytes;         // incl. address bytes
+  uint32_t nacks;
+  uint32_t resets;
+  double   busMicros;     // modeled bus time at the configured speed
+
+  // models a long cable: above this clock every 8th transaction fails with
+  // a data NACK, 0 = never
+  uint32_t flakyAbove;
+  // transactions to this address fail with a data NACK, 0 = none
+  uint8_t  failAddress;
+
+private:
+  std::vector<HostI2CDevice *> _devices;
+  std::vector<HostBusRecord>   _records;
+  bool     _recording;
+  bool     _enabled;
+  uint32_t _clock;
+  uint32_t _flakyCount;
+  uint8_t  _address;
+  uint8_t  _tx[I2C_BUFFER_LENGTH];
+  uint8_t  _txLength;
+  uint8_t  _rx[I2C_BUFFER_LENGTH];
+  uint8_t  _rxLength;
+  uint8_t  _rxPos;
+
+  HostI2CDevice *find(uint8_t address);
+  void record(uint8_t address, bool read, bool ack, const uint8_t *data, uint8_t len);
+
+public:
+  TwoWire();
+};
+extern TwoWire Wire;
+extern TwoWire Wire1;
+
+// byte source, e.g. Serial or a TCPClient on the device
+class Stream {
+public:
+  virtual ~Stream() {}
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+enum LogLevel {
+  LOG_LEVEL_ALL   = 1,
+  LOG_LEVEL_TRACE = 1,
+  LOG_LEVEL_INFO  = 30,
+  LOG_LEVEL_WARN  = 40,
+  LOG_LEVEL_ERROR = 50,
+  LOG_LEVEL_NONE  = 70,
+};
+
+// prints to stderr, warnings and errors only unless level is lowered
+class Logger {
+public:
+  Logger();
+  void trace(const char *format, ...);
+  void info(const char *format, ...);
+  void warn(const char *format, ...);
+  void error(const char *format, ...);
+  int level;
+  uint32_t warnings;      // calls of warn(), whatever the level
+};
+extern Logger Log;
+
+class CloudClass {
+public:
+  void process();
+  bool connected();
+  template <typename T>
+  bool variable(const char * /* name */, T /* value */) { return true; }
+  bool publish(const char * /* name */, const char * /* data */ = NULL) { return true; }
+};
+extern CloudClass Particle;
+
+class Timer {
+public:
+  Timer(unsigned int period, std::function<void()> callback, bool oneShot = false);
+  template <typename T>
+  Timer(unsigned int period, void (T::*callback)(), T &instance, bool oneShot = false)
+    : Timer(period, [callback, &instance]() { (instance.*callback)(); }, oneShot) {}
+  ~Timer();
+  bool start();
+  bool stop();
+  bool reset();
+  bool changePeriod(unsigned int period);
+  bool isActive();
+  void startFromISR();
+  void stopFromISR();
+  void resetFromISR();
+  void changePeriodFromISR(unsigned int period);
+
+  // fires every active timer that is due at now
+  static void runDue(uint32_t now);
+
+private:
+  std::function<void()> _callback;
+  unsigned int _period;
+  bool     _oneShot;
+  bool     _active;
+  uint32_t _due;
+};
+
+class RecursiveMutex {
+public:
+  void lock()     { _mutex.lock(); }
+  bool trylock()  { return _mutex.try_lock(); }
+  bool try_lock() { return _mutex.try_lock(); }
+  void unlock()   { _mutex.unlock(); }
+
+private:
+  std::recursive_mutex _mutex;
+};
+
+class Thread {
+public:
+  Thread(const char * /* name */, std::function<void()> function) : _thread(function) {}
+  ~Thread() { if (_thread.joinable()) _thread.join(); }
+
+private:
+  std::thread _thread;
+};
+
+// counting semaphore with the os_semaphore_* calls of the device
+struct HostSemaphore {
+  std::mutex              mutex;
+  std::condition_variable signal;
+  unsigned                count;
+  unsigned                max;
+};
+typedef HostSemaphore *os_semaphore_t;
+
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial);
+int os_semaphore_destroy(os_semaphore_t semaphore);
+int os_semaphore_take(os_semaphore_t semaphore, uint32_t timeout, bool reserved);
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved);
+
+#endif
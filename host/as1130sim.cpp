@@ -0,0 +1,239 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+===========================================================================
+*/
+#if !defined(PLATFORM_ID)
+
+#include "as1130sim.h"
+
+// register map of the chip, mirrors the enums in beam.h
+enum {
+  SIM_PIC       = 0x00,
+  SIM_MOV       = 0x01,
+  SIM_MOVMODE   = 0x02,
+  SIM_FRAMETIME = 0x03,
+  SIM_DISPLAYO  = 0x04,
+  SIM_IRQMASK   = 0x07,
+  SIM_IRQFRAME  = 0x08,
+  SIM_SHDN      = 0x09,
+  SIM_CLKSYNC   = 0x0B,
+  SIM_IRQSTAT   = 0x0E,
+  SIM_STATUS    = 0x0F,
+  SIM_FRAME0    = 0x01,
+  SIM_SET0      = 0x40,
+  SIM_CTRL      = 0xC0,
+  SIM_REGSEL    = 0xFD,
+};
+
+enum {
+  SIM_IRQ_MOVIE = 0x01,
+  SIM_IRQ_FRAME = 0x80,
+};
+
+AS1130Sim *AS1130Sim::_clockOut = NULL;
+
+AS1130Sim::AS1130Sim(uint8_t address, int rstPin, int irqPin) {
+  _address = address;
+  _rstPin = rstPin;
+  _irqPin = irqPin;
+  resets = 0;
+  drift = 0;
+  reset();
+}
+
+AS1130Sim::~AS1130Sim() {
+  if (_clockOut == this) _clockOut = NULL;
+}
+
+void AS1130Sim::reset() {
+  if (_clockOut == this) _clockOut = NULL;
+  memset(frame, 0x00, sizeof(frame));
+  memset(sets, 0x00, sizeof(sets));
+  memset(ctrl, 0x00, sizeof(ctrl));
+  regsel = 0;
+  pointer = 0;
+  ignored = 0;
+  _running = false;
+  _start = 0;
+  _step = 0;
+  _lag = 0;
+  _frame = 0;
+  _irqLine = false;
+}
+
+uint8_t AS1130Sim::address() const {
+  return _address;
+}
+
+/*
+Register behind reg in the bank selected by REGSEL, NULL if there is none
+*/
+uint8_t *AS1130Sim::cell(uint8_t reg) {
+  if (SIM_FRAME0 <= regsel && regsel < SIM_FRAME0 + FRAMES) {
+    return reg < FRAME_SIZE ? &frame[regsel - SIM_FRAME0][reg] : NULL;
+  }
+  if (SIM_SET0 <= regsel && regsel < SIM_SET0 + SETS) {
+    return reg < SET_SIZE ? &sets[regsel - SIM_SET0][reg] : NULL;
+  }
+  if (regsel == SIM_CTRL) {
+    return reg < sizeof(ctrl) ? &ctrl[reg] : NULL;
+  }
+  return NULL;
+}
+
+/*
+First byte sets the register pointer, every further one is written to it
+and advances it. REGSEL is reachable from every bank.
+*/
+void AS1130Sim::write(const uint8_t *data, size_t len) {
+  if (!len) return;
+  pointer = data[0];
+
+  if (pointer == SIM_REGSEL) {
+    if (len > 1) regsel = data[len - 1];
+    return;
+  }
+
+  for (size_t i = 1; i < len; i++, pointer++) {
+    uint8_t *reg = cell(pointer);
+    if (!reg) {
+      ignored++;
+      continue;
+    }
+    if (regsel == SIM_CTRL && _running && (pointer == SIM_MOV || pointer == SIM_MOVMODE)) {
+      // the new movie starts after the frame on display
+      uint32_t now = micros();
+      update(now);
+      _start += _step * frameTime();
+      _step = 0;
+      _lag = 1;
+    }
+    *reg = data[i];
+
+    if (regsel == SIM_CTRL && pointer == SIM_CLKSYNC) {
+      if (data[i] & 0x02) _clockOut = this;
+      else if (_clockOut == this) _clockOut = NULL;
+    }
+    if (regsel == SIM_CTRL && pointer == SIM_SHDN) {
+      bool run = data[i] & 0x01;
+      if (run && !_running) start(micros());
+      _running = run;
+    }
+  }
+}
+
+/*
+Reads advance the pointer as writes do, reading IRQSTAT clears it
+*/
+uint8_t AS1130Sim::read() {
+  if (regsel == SIM_CTRL) update(micros());
+
+  uint8_t *reg = cell(pointer);
+  uint8_t data = reg ? *reg : 0x00;
+
+  if (regsel == SIM_CTRL && pointer == SIM_IRQSTAT) {
+    ctrl[SIM_IRQSTAT] = 0x00;
+    _irqLine = false;
+  }
+  pointer++;
+  return data;
+}
+
+void AS1130Sim::pinChanged(int pin, int level) {
+  if (pin == _rstPin && level == LOW) {
+    reset();
+    resets++;
+  }
+}
+
+void AS1130Sim::tick(uint32_t now) {
+  update(now);
+}
+
+bool AS1130Sim::running() {
+  return _running;
+}
+
+uint8_t AS1130Sim::frameOnDisplay() {
+  update(micros());
+  return _frame;
+}
+
+/*
+LED x (0..23, left to right) in row (0..4) of a frame
+*/
+bool AS1130Sim::led(uint8_t f, uint8_t x, uint8_t row) const {
+  return (word(f, x / 2) >> ((x % 2) * 5 + row)) & 0x01;
+}
+
+uint16_t AS1130Sim::word(uint8_t f, uint8_t cs) const {
+  return frame[f][cs * 2] | (frame[f][cs * 2 + 1] & 0x03) << 8;
+}
+
+void AS1130Sim::start(uint32_t now) {
+  _start = now;
+  _step = 0;
+  _lag = 0;
+  _frame = (ctrl[SIM_MOV] & 0x40) ? (ctrl[SIM_MOV] & 0x3F) : (ctrl[SIM_PIC] & 0x3F);
+  ctrl[SIM_STATUS] = _frame << 2;
+}
+
+uint32_t AS1130Sim::frameTime() const {
+  uint32_t time = ((ctrl[SIM_FRAMETIME] & 0x0F) ? (ctrl[SIM_FRAMETIME] & 0x0F) : 1) * 32500;
+  // a chip following the clock sync line runs on the oscillator driving it
+  int32_t ppm = drift;
+  if (ctrl[SIM_CLKSYNC] & 0x01) ppm = _clockOut ? _clockOut->drift : 0;
+  return time + (int64_t)time * ppm / 1000000;
+}
+
+/*
+Follows the display to time now: a movie runs from the start frame in MOV
+to the last frame in MOVMODE, FRAMETIME[3:0] x 32.5 ms per frame, for the
+loops in DISPLAYO[7:5] (7 = endless); otherwise the picture in PIC stays.
+Raises IRQ_FRAME when IRQFRAME comes on display and IRQ_MOVIE at the end.
+*/
+void AS1130Sim::update(uint32_t now) {
+  if (!_running) return;
+
+  if (ctrl[SIM_MOV] & 0x40) {
+    uint8_t first = ctrl[SIM_MOV] & 0x3F;
+    uint8_t last = ctrl[SIM_MOVMODE] & 0x3F;
+    uint32_t length = (last >= first) ? last - first + 1 : 1;
+    uint8_t loops = ctrl[SIM_DISPLAYO] >> 5;
+
+    uint32_t steps = length * (loops ? loops : 1) + _lag;
+    uint32_t step = (now - _start) / frameTime();
+    while (_step < step && (loops == 7 || _step < steps)) {
+      _step++;
+      if (loops != 7 && _step == steps) {
+        // the last frame stays on display
+        ctrl[SIM_IRQSTAT] |= SIM_IRQ_MOVIE;
+        break;
+      }
+      _frame = first + (_step - _lag) % length;
+      if (_frame == (ctrl[SIM_IRQFRAME] & 0x3F)) {
+        ctrl[SIM_IRQSTAT] |= SIM_IRQ_FRAME;
+      }
+    }
+  }
+  else if (ctrl[SIM_PIC] & 0x40) {
+    _frame = ctrl[SIM_PIC] & 0x3F;
+  }
+
+  ctrl[SIM_STATUS] = _frame << 2;
+
+  // the IRQ pin is open drain and active low, the ISR runs on its falling edge
+  bool line = ctrl[SIM_IRQSTAT] & ctrl[SIM_IRQMASK];
+  if (line && !_irqLine && _irqPin >= 0) hostInterrupt(_irqPin);
+  _irqLine = line;
+}
+
+#endif
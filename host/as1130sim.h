@@ -0,0 +1,80 @@
+﻿#pragma once
+/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Behavioral model of the AS1130 LED driver of a Beam for host builds. It
+keeps the register banks selected through REGSEL (36 frames, 6 blink/PWM
+sets, CTRL), auto-increments the register pointer, and plays pictures and
+movies against the simulated clock so STATUS (frame on display), IRQSTAT
+and the IRQ pin behave like the chip's. A running movie picks up changes
+of MOV and MOVMODE when the frame on display is done. Scroll and fade
+effects are not rendered, only the frame sequence.
+
+  AS1130Sim beamA(BEAMA, rstPin, irqPin);
+  Wire.attach(&beamA);
+
+===========================================================================
+*/
+#include "Particle.h"
+
+class AS1130Sim : public HostI2CDevice {
+public:
+  static const int FRAMES = 36;
+  static const int SETS = 6;
+  static const int SET_SIZE = 0x9C;      // 24 blink bytes, 132 PWM bytes
+  static const int FRAME_SIZE = 24;
+
+  AS1130Sim(uint8_t address, int rstPin = -1, int irqPin = -1);
+  ~AS1130Sim();
+
+  // power on state: all registers cleared, chip shut down
+  void reset();
+
+  uint8_t address() const override;
+  void write(const uint8_t *data, size_t len) override;
+  uint8_t read() override;
+  void pinChanged(int pin, int level) override;
+  void tick(uint32_t now) override;
+
+  bool running();
+  uint8_t frameOnDisplay();
+  bool led(uint8_t frame, uint8_t x, uint8_t row) const;
+  uint16_t word(uint8_t frame, uint8_t cs) const;
+
+  uint8_t  frame[FRAMES][FRAME_SIZE];
+  uint8_t  sets[SETS][SET_SIZE];
+  uint8_t  ctrl[16];
+  uint8_t  regsel;
+  uint8_t  pointer;
+  uint32_t resets;          // by the RST pin
+  int32_t  drift;           // ppm the oscillator is slow (> 0) or fast; with
+                            // CLKSYNC in the chip runs on the one driving the
+                            // clock sync line (CLKSYNC out) instead
+  uint32_t ignored;         // bytes written outside the selected bank
+
+private:
+  uint8_t *cell(uint8_t reg);
+  void update(uint32_t now);
+  void start(uint32_t now);
+  uint32_t frameTime() const;
+
+  static AS1130Sim *_clockOut;  // chip driving the clock sync line
+  uint8_t  _address;
+  int      _rstPin;
+  int      _irqPin;
+  bool     _running;        // SHDN bit 0, normal operation
+  uint32_t _start;          // micros() when the display started
+  uint32_t _step;           // frames played since _start
+  uint32_t _lag;            // 1 while the frame of an old movie is on display
+  uint8_t  _frame;          // frame on display
+  bool     _irqLine;        // IRQ pin held low
+};
@@ -0,0 +1,171 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+I2C cost of the public Beam operations, measured on the host bus against
+AS1130Sim for 1 to 4 beams, 8 and 16 beams behind a TCA9548A mux, and
+several message lengths:
+
+  g++ -std=gnu++14 -O2 -funsigned-char -Wall -Wextra -Ihost -I. -o beambench \
+      host/beambench.cpp beam.cpp beamrender.cpp beamcanvas.cpp beamanim.cpp \
+      beamsync.cpp host/particle_host.cpp host/as1130sim.cpp host/tca9548sim.cpp
+  ./beambench > bench.jsonl
+
+(or build the beambench target of CMakeLists.txt in this directory)
+
+Prints one JSON object per operation and line:
+  op, beams, length   operation, chain length, message length (0 = none)
+  tx, bytes           transactions, bytes on the wire incl. address bytes
+  bus100_us, bus400_us, bus1000_us
+                      modeled bus time at 100 kHz, 400 kHz and 1 MHz
+  cpu_us              host CPU time of the call (bus time not included)
+
+Operations named *_warm repeat the previous call on unchanged chips, *_edit
+changes a single character of the message, present_pixel a single pixel of
+the canvas, animation_frame steps a playing animation one frame on,
+bank_next uploads the other bank while the first one plays, scroll_step
+moves text scrolled by scrollText() on by a column.
+
+===========================================================================
+*/
+#if !defined(PLATFORM_ID)
+
+#include <time.h>
+#include <string>
+#include "beam.h"
+#include "as1130sim.h"
+#include "tca9548sim.h"
+
+#define RSTPIN 2
+#define IRQPIN 9
+
+static std::vector<AS1130Sim> chips;
+static TCA9548Sim mux(BEAM_MUX_ADDRESS);
+
+static const int chains[] = { 1, 2, 3, 4, 8, 16 };
+static const int lengths[] = { 8, 32, 128 };
+
+static std::string message(int length) {
+  static const char pangram[] = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG. ";
+  std::string text;
+  while ((int)text.size() < length) text += pangram[text.size() % (sizeof(pangram) - 1)];
+  return text;
+}
+
+static double cpuMicros() {
+  timespec now;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/*
+Runs op and prints what it cost on the bus
+*/
+template <typename Op>
+static void measure(const char *name, int beams, int length, Op op) {
+  Wire.clearRecords();
+  double start = cpuMicros();
+  op();
+  double cpu = cpuMicros() - start;
+
+  uint32_t tx = 0, bytes = 0;
+  double bus100 = 0, bus400 = 0, bus1000 = 0;
+  for (const HostBusRecord &rec : Wire.records()) {
+    size_t len = rec.ack ? rec.length : 0;
+    tx++;
+    bytes += len + 1;
+    bus100 += TwoWire::busTime(len, 100000);
+    bus400 += TwoWire::busTime(len, 400000);
+    bus1000 += TwoWire::busTime(len, 1000000);
+  }
+
+  printf("{\"op\":\"%s\",\"beams\":%d,\"length\":%d,\"tx\":%u,\"bytes\":%u,"
+         "\"bus100_us\":%.0f,\"bus400_us\":%.0f,\"bus1000_us\":%.0f,\"cpu_us\":%.1f}\n",
+         name, beams, length, tx, bytes, bus100, bus400, bus1000, cpu);
+}
+
+int main() {
+  Wire.setRecording(true);
+  for (int c = 0; c < MAXBEAMS; c++) chips.emplace_back(BEAM_ADDRESS[c % BEAM_PER_BUS], RSTPIN, IRQPIN);
+
+  for (int beams : chains) {
+    // up to BEAM_PER_BUS beams on the bus, more behind the mux
+    bool muxed = beams > BEAM_PER_BUS;
+    for (int c = 0; c < beams; c++) {
+      if (muxed) mux.attach(c / BEAM_PER_BUS, &chips[c]);
+      else Wire.attach(&chips[c]);
+    }
+    if (muxed) Wire.attach(&mux);
+
+    Beam beam(RSTPIN, IRQPIN, beams);
+    if (muxed) measure("begin", beams, 0, [&]() { beam.begin(Wire, BEAM_MUX_ADDRESS); });
+    else measure("begin", beams, 0, [&]() { beam.begin(); });
+    measure("initBeam", beams, 0, [&]() { beam.initBeam(); });
+    measure("initBeam_warm", beams, 0, [&]() { beam.initBeam(); });
+
+    for (int length : lengths) {
+      std::string text = message(length);
+      measure("print", beams, length, [&]() { beam.print(text.c_str()); });
+      measure("print_warm", beams, length, [&]() { beam.print(text.c_str()); });
+      text[length / 2] = '*';
+      measure("print_edit", beams, length, [&]() { beam.print(text.c_str()); });
+      measure("printFrame", beams, length, [&]() { beam.printFrame(1, text.c_str()); });
+    }
+
+    measure("play", beams, 0, [&]() { beam.play(); });
+    measure("draw", beams, 0, [&]() { beam.draw(); });
+    measure("draw_warm", beams, 0, [&]() { beam.draw(); });
+    measure("display", beams, 0, [&]() { beam.display(); });
+
+    BeamCanvas canvas(beams);
+    canvas.text(0, "12:34");
+    measure("present", beams, 0, [&]() { beam.present(canvas); });
+    canvas.setPixel(canvas.width() - 1, 0);
+    measure("present_pixel", beams, 0, [&]() { beam.present(canvas); });
+    // a clock whose seconds tick on, one frame per second
+    std::vector<uint8_t> frames, data(1024);
+    for (int f = 0; f < 2; f++) {
+      canvas.clear();
+      canvas.text(0, f ? "12:35" : "12:34");
+      frames.insert(frames.end(), canvas.columns(0), canvas.columns(0) + canvas.width());
+    }
+    data.resize(beamEncodeAnimation(frames.data(), 2, beams, NULL, 100, BEAM_ANIMATION_LOOP,
+                                    data.data(), data.size()));
+    BeamAnimation animation(data.data(), data.size());
+    measure("animation", beams, 0, [&]() { beam.playAnimation(animation); });
+    measure("animation_frame", beams, 0, [&]() { delay(1000); beam.updateAnimation(); });
+    beam.stopAnimation();
+    measure("bank", beams, 0, [&]() { beam.loadBank(frames.data(), 1, beams); });
+    measure("bank_next", beams, 0, [&]() { beam.loadBank(frames.data() + canvas.width(), 1, beams); });
+    beam.stopBanks();
+    beam.scrollText("12:34", 30, false);
+    for (int step = 0; step < 20; step++) {
+      delay(34);
+      beam.updateScroll();
+    }
+    measure("scroll_step", beams, 0, [&]() { delay(34); beam.updateScroll(); });
+    beam.stopScroll();
+    measure("setSpeed", beams, 0, [&]() { beam.setSpeed(3); });
+    measure("setScroll", beams, 0, [&]() { beam.setScroll(RIGHT, FADEON); });
+    measure("setLoops", beams, 0, [&]() { beam.setLoops(2); });
+    measure("setMode", beams, 0, [&]() { beam.setMode(MOVIE); });
+    measure("status", beams, 0, [&]() { beam.status(); });
+
+    for (int c = 0; c < beams; c++) {
+      Wire.detach(&chips[c]);
+      mux.detach(&chips[c]);
+    }
+    Wire.detach(&mux);
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,1629 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Host tests of the Beam library against AS1130Sim, built and run with the
+CMakeLists.txt in this directory:
+
+  cmake -S host -B build && cmake --build build && ctest --test-dir build
+
+or by hand:
+
+  g++ -std=gnu++14 -funsigned-char -pthread -Wall -Wextra -Ihost -I. -o beamtest \
+      host/beamtest.cpp beam.cpp beamrender.cpp beamcanvas.cpp beamanim.cpp \
+      beamsync.cpp host/particle_host.cpp host/as1130sim.cpp host/tca9548sim.cpp
+  ./beamtest [test]
+
+Runs every test, or the one named, and exits with the number of failed
+checks.
+
+===========================================================================
+*/
+#if !defined(PLATFORM_ID)
+
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "beam.h"
+#include "beamsync.h"
+#include "as1130sim.h"
+#include "tca9548sim.h"
+#include "charactermap.h"
+#include "frames.h"
+
+#define RSTPIN 2
+#define IRQPIN 9
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+/*
+Chips of a chain of beams on Wire, BEAMA first, detached again at the end
+of the test. Spread over two buses the first onWire chips are on Wire and
+the rest on Wire1, again from BEAMA on.
+*/
+struct Chain {
+  std::vector<AS1130Sim> chips;
+
+  Chain(int beams) {
+    chips.reserve(beams);
+    for (int c = 0; c < beams; c++) chips.emplace_back(BEAM_ADDRESS[c % BEAM_PER_BUS], RSTPIN, IRQPIN);
+    for (AS1130Sim &chip : chips) Wire.attach(&chip);
+  }
+  Chain(int beams, int onWire) {
+    chips.reserve(beams);
+    for (int c = 0; c < beams; c++) {
+      bool second = c >= onWire;
+      chips.emplace_back(BEAM_ADDRESS[second ? c - onWire : c], RSTPIN, IRQPIN);
+      (second ? Wire1 : Wire).attach(&chips.back());
+    }
+  }
+  ~Chain() {
+    for (AS1130Sim &chip : chips) {
+      Wire.detach(&chip);
+      Wire1.detach(&chip);
+    }
+  }
+};
+
+static uint64_t fnv(uint64_t hash, const uint8_t *data, size_t len) {
+  while (len--) hash = (hash ^ *data++) * 1099511628211ULL;
+  return hash;
+}
+
+/*
+Frames and the CTRL registers up to CLKSYNC of chip, which is what the
+library sets up (STATUS and IRQSTAT change as the chip plays)
+*/
+static uint64_t chipState(const AS1130Sim &chip, uint64_t hash = 1469598103934665603ULL) {
+  hash = fnv(hash, &chip.frame[0][0], sizeof(chip.frame));
+  return fnv(hash, chip.ctrl, 12);
+}
+
+static uint64_t chainState(const std::vector<AS1130Sim> &chips) {
+  uint64_t hash = 1469598103934665603ULL;
+  for (const AS1130Sim &chip : chips) hash = chipState(chip, hash);
+  return hash;
+}
+
+/*
+Frame writes sent since recording started, i.e. data written while REGSEL
+of the chip selects a frame
+*/
+static int frameWrites(const std::vector<AS1130Sim> &chips) {
+  uint8_t regsel[128] = { 0 };
+  for (const AS1130Sim &chip : chips) regsel[chip.address()] = chip.regsel;
+
+  int writes = 0;
+  for (const HostBusRecord &rec : Wire.records()) {
+    if (rec.read || !rec.ack || !rec.length || rec.address >= sizeof(regsel)) continue;
+    if (rec.data[0] == 0xFD) regsel[rec.address] = rec.data[rec.length - 1];
+    else if (0x01 <= regsel[rec.address] && regsel[rec.address] <= 0x24) writes++;
+  }
+  return writes;
+}
+
+static const char *texts[] = {
+  "HELLO",
+  "Hello World. This is Beam!",
+  "0123456789 +-*/",
+  "A",
+  "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG",
+};
+
+/*
+print() leaves the chips as the library did before the render stage and
+the register shadow, captured with the original implementation
+*/
+static void print_baseline() {
+  static const struct {
+    int      beams;
+    int      text;
+    uint64_t state;
+  } baseline[] = {
+    { 1, 0, 0x95cf93fb65d81a4aULL },
+    { 1, 1, 0xfd3188b8e409301bULL },
+    { 1, 2, 0xc06666c6091cc57eULL },
+    { 1, 3, 0x1e06e59d9480f357ULL },
+    { 1, 4, 0x6c86d34acb8e1035ULL },
+    { 2, 0, 0x083b76a07d671bc6ULL },
+    { 2, 1, 0x32038bc9d02799e6ULL },
+    { 2, 2, 0x11627585498d47c2ULL },
+    { 2, 3, 0x9652167467fdbc36ULL },
+    { 2, 4, 0x34af43f1e2bf57aeULL },
+    { 3, 0, 0x8bb3671e037a85feULL },
+    { 3, 1, 0xa9cdbdd86960ebe7ULL },
+    { 3, 2, 0x52c296bf22aee032ULL },
+    { 3, 3, 0x9d3d931dba1609cfULL },
+    { 3, 4, 0x7f0afb5d0304ce71ULL },
+  };
+
+  for (const auto &expected : baseline) {
+    Chain chain(expected.beams);
+    Beam beam(RSTPIN, IRQPIN, expected.beams);
+    beam.begin();
+    beam.initBeam();
+    beam.print(texts[expected.text]);
+    CHECK(chainState(chain.chips) == expected.state);
+  }
+}
+
+/*
+Printing the text already on the chips sends no frames
+*/
+static void print_warm() {
+  for (int beams = 1; beams <= 4; beams++) {
+    Chain chain(beams);
+    Beam beam(RSTPIN, IRQPIN, beams);
+    beam.begin();
+    beam.initBeam();
+    beam.print(texts[1]);
+
+    Wire.clearRecords();
+    beam.print(texts[1]);
+    CHECK(frameWrites(chain.chips) == 0);
+
+    Wire.clearRecords();
+    beam.print(texts[4]);
+    CHECK(frameWrites(chain.chips) > 0);
+  }
+  Wire.clearRecords();
+}
+
+/*
+Runs the same operations on beam as every test of the transfer engines does
+*/
+template <typename Wait>
+static void runScript(Beam &beam, Wait wait) {
+  beam.initBeam();
+  beam.print(texts[1]);
+  beam.setSpeed(3);
+  wait();
+  beam.play();
+  wait();
+  beam.print(texts[4]);
+  beam.setLoops(2);
+  beam.display();
+  wait();
+}
+
+static std::vector<uint64_t> syncStates(int beams) {
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin();
+  runScript(beam, []() {});
+
+  std::vector<uint64_t> states;
+  for (const AS1130Sim &chip : chain.chips) states.push_back(chipState(chip));
+  return states;
+}
+
+/*
+The queue, pumped by hand or from the timer, leaves the chips as the
+synchronous transfers do
+*/
+static void async_equal() {
+  for (int beams = 1; beams <= 3; beams++) {
+    std::vector<uint64_t> expected = syncStates(beams);
+
+    for (uint8_t mode : { ASYNC_PUMP, ASYNC_TIMER }) {
+      Chain chain(beams);
+      Beam beam(RSTPIN, IRQPIN, beams);
+      beam.setAsync(mode);
+      beam.begin();
+      runScript(beam, [&]() {
+        for (int i = 0; i < 10000 && beam.pending(); i++) {
+          // time passes between the calls as it would in loop()
+          if (mode == ASYNC_PUMP) beam.pump(2000);
+          delay(1);
+        }
+      });
+      CHECK(beam.pending() == 0);
+      for (int c = 0; c < beams; c++) CHECK(chipState(chain.chips[c]) == expected[c]);
+    }
+  }
+}
+
+/*
+A chain spread over two buses ends up as the same chain on one bus
+*/
+static void two_bus_equal() {
+  for (int beams = 2; beams <= 4; beams++) {
+    std::vector<uint64_t> expected = syncStates(beams);
+
+    int onWire = beams / 2;
+    std::vector<AS1130Sim> chips;
+    chips.reserve(beams);
+    for (int c = 0; c < beams; c++) {
+      bool second = c >= onWire;
+      chips.emplace_back(BEAM_ADDRESS[second ? c - onWire : c], RSTPIN, IRQPIN);
+      (second ? Wire1 : Wire).attach(&chips.back());
+    }
+
+    {
+      Beam beam(RSTPIN, IRQPIN, beams);
+      beam.begin(Wire, Wire1, onWire);
+      runScript(beam, []() {});
+    }
+    for (int c = 0; c < beams; c++) CHECK(chipState(chips[c]) == expected[c]);
+
+    for (AS1130Sim &chip : chips) {
+      Wire.detach(&chip);
+      Wire1.detach(&chip);
+    }
+  }
+}
+
+static int doneJob;
+static bool doneOk;
+
+static void recordDone(Beam & /* beam */, uint8_t job, bool ok) {
+  doneJob = job;
+  doneOk = ok;
+}
+
+/*
+A beam missing on the second bus fails the job when only the worker
+thread, flushing frames there, finds out
+*/
+static void two_bus_errors() {
+  const int beams = 4;
+  Chain chain(beams, beams / 2);
+  AS1130Sim &last = chain.chips[beams - 1];
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin(Wire, Wire1, beams / 2);
+  beam.onDone(recordDone);
+  BeamCanvas canvas(beams);
+  canvas.text(0, "ONE TWO THREE FOUR");
+  beam.present(canvas);
+  CHECK(doneJob == JOB_DISPLAY && doneOk);
+
+  // the CTRL registers stay as they are, only frame 0 of the last beam changes
+  Wire1.detach(&last);
+  canvas.setPixel(canvas.width() - 1, 0);
+  doneOk = true;
+  beam.present(canvas);
+  CHECK(doneJob == JOB_DISPLAY && !doneOk);
+
+  Wire1.attach(&last);
+  beam.present(canvas);
+  CHECK(doneJob == JOB_DISPLAY && doneOk);
+}
+
+/*
+Every beam of a streaming chain shows the frames of the text in order,
+followed by a blank frame per beam, over and over, while the ring of 36
+frames on the chips gets refilled behind the frame on display
+*/
+static void stream_order() {
+  std::string text;
+  for (int i = 0; i < 8; i++) text += "Stream number " + std::to_string(i) + ". ";
+
+  for (int beams = 1; beams <= 3; beams++) {
+    std::vector<std::vector<uint16_t>> expected;
+    while (expected.size() < 200) {
+      BeamRenderer renderer(text.c_str());
+      uint16_t cs[12] = { 0 };
+      while (renderer.nextFrame(cs)) {
+        expected.push_back(std::vector<uint16_t>(cs, cs + 12));
+        memset(cs, 0x00, sizeof(cs));
+      }
+      for (int b = 0; b < beams; b++) expected.push_back(std::vector<uint16_t>(12, 0));
+    }
+    CHECK(expected.size() > 2 * MAXFRAME);
+
+    Chain chain(beams);
+    Beam beam(RSTPIN, IRQPIN, beams);
+    beam.begin();
+    beam.initBeam();
+    beam.printStream(text.c_str());
+    beam.play();
+
+    // frames as they come on display
+    std::vector<std::vector<std::vector<uint16_t>>> shown(beams);
+    std::vector<int> last(beams, -1);
+    for (int step = 0; step < 2000; step++) {
+      for (int c = 0; c < beams; c++) {
+        AS1130Sim &chip = chain.chips[c];
+        if (!chip.running() || chip.frameOnDisplay() == last[c]) continue;
+        last[c] = chip.frameOnDisplay();
+        std::vector<uint16_t> words;
+        for (int k = 0; k < 12; k++) words.push_back(chip.word(last[c], k));
+        shown[c].push_back(words);
+      }
+      delay(10);
+      beam.updateStream();
+    }
+
+    for (int c = 0; c < beams; c++) {
+      // the frames before the text reaches the beam are blank
+      size_t first = 0;
+      while (first < shown[c].size() && shown[c][first] != expected[0]) first++;
+      CHECK(shown[c].size() - first > 2 * MAXFRAME);
+
+      size_t bad = 0;
+      for (size_t i = first; i < shown[c].size(); i++) {
+        if (shown[c][i] != expected[i - first]) bad++;
+      }
+      CHECK(bad == 0);
+    }
+  }
+}
+
+/*
+A beam that gets unplugged goes offline while the rest of the chain
+carries on, and comes back with what it missed once it answers again
+*/
+static void offline_recovery() {
+  Chain chain(3);
+  AS1130Sim &unplugged = chain.chips[1];
+  Beam beam(RSTPIN, IRQPIN, 3);
+  beam.begin();
+  beam.initBeam();
+  beam.print(texts[0]);
+  beam.play();
+
+  Wire.detach(&unplugged);
+  unplugged.reset();
+  beam.print(texts[1]);
+  beam.play();
+  CHECK(!beam.isOnline(1));
+  CHECK(beam.isOnline(0) && beam.isOnline(2));
+  CHECK(chain.chips[0].running() && chain.chips[2].running());
+
+  Wire.attach(&unplugged);
+  delay(BEAM_PROBE_INTERVAL + 100);
+  beam.setSpeed(4);
+  CHECK(beam.isOnline(1));
+  CHECK(unplugged.running());
+
+  Chain reference(3);
+  for (AS1130Sim &chip : chain.chips) Wire.detach(&chip);
+  Beam fresh(RSTPIN, IRQPIN, 3);
+  fresh.begin();
+  fresh.initBeam();
+  fresh.print(texts[1]);
+  fresh.play();
+  fresh.setSpeed(4);
+  CHECK(chipState(unplugged) == chipState(reference.chips[1]));
+}
+
+/*
+A single failed write has the beam it went to replayed from the shadow,
+the other beams are not reset
+*/
+static void missed_write() {
+  Chain chain(3);
+  AS1130Sim &flaky = chain.chips[1];
+  Beam beam(RSTPIN, IRQPIN, 3);
+  beam.begin();
+  beam.initBeam();
+  beam.print(texts[0]);
+  beam.play();
+  uint32_t resets = chain.chips[0].resets;
+
+  Wire.detach(&flaky);
+  flaky.reset();
+  beam.setSpeed(9);
+  Wire.attach(&flaky);
+  CHECK(beam.isOnline(1));
+
+  beam.print(texts[1]);
+  CHECK(chain.chips[0].resets == resets);
+  CHECK(chain.chips[2].resets == resets);
+
+  Chain reference(3);
+  for (AS1130Sim &chip : chain.chips) Wire.detach(&chip);
+  Beam fresh(RSTPIN, IRQPIN, 3);
+  fresh.begin();
+  fresh.initBeam();
+  fresh.print(texts[1]);
+  CHECK(chipState(flaky) == chipState(reference.chips[1]));
+}
+
+/*
+The text layout of print() as it was written inline before the render
+stage: frames of a chain of beams (frame + beams - b on beam b, like
+print()), all blank but the ones holding text
+*/
+static void legacyPrint(const char *text, int beams, uint16_t (*chips)[MAXFRAME][12]) {
+  uint16_t cs[12] = { 0 };
+  uint8_t  cscolumn[25] = { 0 };
+  memset(chips, 0x00, beams * sizeof(*chips));
+
+  auto writeFrame = [&](int frame) {
+    for (int b = 0; b < beams; b++) {
+      int f = frame + (beams - b);
+      if (f < MAXFRAME) memcpy(chips[b][f], cs, sizeof(cs));
+    }
+  };
+
+  int i = 0;
+  const uint8_t *fontptr;
+  int frame = 0;
+  int asciiVal;
+  int cscount = 0;
+  int stringLen = strlen(text);
+
+  while ((i < stringLen) && frame < 36) {
+    asciiVal = toupper(text[i]);
+    if (32 <= asciiVal && asciiVal <= 96) {
+      fontptr = &charactermap[(asciiVal - 32)][0];
+    }
+    else {
+      switch (text[i]) {
+        case 0xC3:
+          i++;
+          continue;
+        case 0x84:
+        case 0xA4:
+          fontptr = &charactermap[65][0];
+          break;
+        case 0x96:
+        case 0xB6:
+          fontptr = &charactermap[66][0];
+          break;
+        case 0x9C:
+        case 0xBC:
+          fontptr = &charactermap[67][0];
+          break;
+        case 0x9F:
+          fontptr = &charactermap[68][0];
+          break;
+        default:
+          fontptr = &charactermap[0][0];
+          break;
+      }
+    }
+
+    while (cscount < 24 && *fontptr != 0xFF) {
+      cscolumn[cscount] = *fontptr;
+      fontptr++;
+      cscount++;
+    }
+    i++;
+
+    if (cscount > 23) {
+      for (int j = 0; j < 12; j++) {
+        cs[j] = (cscolumn[j * 2]) | (cscolumn[j * 2 + 1] << 5);
+      }
+      writeFrame(frame);
+      for (int x = 0; x < 12; x++) {
+        cs[x] = 0x00;
+        cscolumn[x * 2] = 0x00;
+        cscolumn[x * 2 + 1] = 0x00;
+      }
+      frame++;
+      cscount = 0;
+
+      if (*fontptr != 0xFF) {
+        while (cscount < 24 && *fontptr != 0xFF) {
+          cscolumn[cscount] = *fontptr;
+          fontptr++;
+          cscount++;
+        }
+      }
+    }
+
+    if (stringLen == i) {
+      for (int j = 0; j < 12; j++) {
+        cs[j] = (cscolumn[j * 2]) | (cscolumn[j * 2 + 1] << 5);
+      }
+      writeFrame(frame);
+      for (int x = 0; x < 12; x++) {
+        cs[x] = 0x00;
+        cscolumn[x * 2] = 0x00;
+        cscolumn[x * 2 + 1] = 0x00;
+      }
+    }
+  }
+}
+
+/*
+The frameList conversion of draw() before the render stage, bit by bit
+through the segment masks
+*/
+static void legacyConvertFrame(const uint8_t *currentFrame, uint16_t *cs) {
+  uint16_t segmentmask[8];
+  for (int s = 0; s < 8; s++) segmentmask[s] = 0x0001 << (7 - s);
+  memset(cs, 0x00, 12 * sizeof(uint16_t));
+
+  for (int start = 0; start < 3; start++) {
+    int n = start;
+    for (int y = 10; y > 0; --y) {
+      int i = (y < 6) ? 1 : 0;
+      for (int k = 0; k < 4; k++) {
+        cs[start * 4 + k] |= (((uint16_t)(*(currentFrame + n) & segmentmask[k * 2 + i]) << (3 + k * 2 + i)) >> y);
+      }
+      n += 3;
+      if (n > 12 + start) n = start;
+    }
+  }
+}
+
+static std::vector<std::string> renderTexts() {
+  std::vector<std::string> texts(std::begin(::texts), std::end(::texts));
+  texts.push_back("");
+  texts.push_back("lower case, {braces} | ~tilde");
+  texts.push_back("\xC3\x84pfel \xC3\x96l \xC3\x9C \xC3\xA4\xC3\xB6\xC3\xBC \xC3\x9F");
+  texts.push_back("\x01\x7F\xFE");
+  std::string pangram;
+  for (int i = 0; i < 4; i++) pangram += texts[4] + " ";
+  texts.push_back(pangram);
+  // every way a character can end at or across the end of a frame
+  for (char c : { 'I', 'W', '.', ' ' }) {
+    for (int n = 1; n <= 16; n++) texts.push_back(std::string(n, c));
+  }
+  return texts;
+}
+
+/*
+beamRender() and print() lay text out on the chips of chains of 1 to 4
+beams as the inline renderer did, BeamRenderer hands out the same frames
+one at a time
+*/
+static void render_legacy() {
+  static uint16_t expected[4][MAXFRAME][12];
+
+  for (const std::string &text : renderTexts()) {
+    BeamImage image;
+    beamRender(text.c_str(), image);
+
+    BeamRenderer renderer(text.c_str());
+    uint16_t cs[12];
+    int frames = 0;
+    for (; frames < image.frames; frames++) {
+      memset(cs, 0x00, sizeof(cs));
+      if (!renderer.nextFrame(cs)) break;
+      CHECK(!memcmp(cs, image.cs[frames], sizeof(cs)));
+    }
+    CHECK(frames == image.frames);
+
+    for (int beams = 1; beams <= 4; beams++) {
+      legacyPrint(text.c_str(), beams, expected);
+
+      Chain chain(beams);
+      Beam beam(RSTPIN, IRQPIN, beams);
+      beam.begin();
+      beam.initBeam();
+      beam.print(text.c_str());
+      for (int b = 0; b < beams; b++) {
+        for (int f = 0; f < MAXFRAME; f++) {
+          bool same = true;
+          for (int k = 0; k < 12; k++) same &= chain.chips[b].word(f, k) == expected[b][f][k];
+          if (!same) printf("  \"%s\" on %d beams: beam %d frame %d\n", text.c_str(), beams, b, f);
+          CHECK(same);
+        }
+      }
+    }
+  }
+}
+
+/*
+beamConvertFrame() at runtime and beamConvertFrames() at compile time give
+the CS words the segment mask conversion did
+*/
+static void convert_frames() {
+  static constexpr BeamFrames converted = beamConvertFrames(frameList);
+  uint16_t expected[12], cs[12];
+
+  for (int f = 0; f < MAXFRAME; f++) {
+    legacyConvertFrame(frameList[f], expected);
+    CHECK(!memcmp(converted.cs[f], expected, sizeof(expected)));
+    beamConvertFrame(frameList[f], cs);
+    CHECK(!memcmp(cs, expected, sizeof(expected)));
+  }
+
+  uint32_t seed = 1;
+  for (int n = 0; n < 1000; n++) {
+    uint8_t rows[15];
+    for (uint8_t &row : rows) row = (seed = seed * 1103515245 + 12345) >> 16;
+    legacyConvertFrame(rows, expected);
+    beamConvertFrame(rows, cs);
+    CHECK(!memcmp(cs, expected, sizeof(expected)));
+  }
+}
+
+/*
+beamPackColumns() packs columns as the inline renderer did
+*/
+static void pack_columns() {
+  uint32_t seed = 7;
+  for (int n = 0; n < 1000; n++) {
+    uint8_t columns[24];
+    for (uint8_t &column : columns) column = ((seed = seed * 1103515245 + 12345) >> 16) & 0x1F;
+
+    uint16_t cs[12];
+    beamPackColumns(columns, cs);
+    for (int j = 0; j < 12; j++) CHECK(cs[j] == (columns[j * 2] | columns[j * 2 + 1] << 5));
+  }
+}
+
+/*
+A chain behind the mux: every beam gets its own part of the text, the mux
+only switches when the next transfer goes to another channel, and a
+layout with room for fewer beams than the chain has drops the rest with
+a warning
+*/
+static void mux_layout() {
+  const int beams = 8;
+  const int perChannel = 2;
+  TCA9548Sim mux(BEAM_MUX_ADDRESS);
+  std::vector<AS1130Sim> chips;
+  chips.reserve(beams);
+  for (int c = 0; c < beams; c++) {
+    chips.emplace_back(BEAM_ADDRESS[c % perChannel], RSTPIN, IRQPIN);
+    mux.attach(c / perChannel, &chips.back());
+  }
+  Wire.attach(&mux);
+
+  {
+    Beam beam(RSTPIN, IRQPIN, beams);
+    uint32_t warnings = Log.warnings;
+    beam.begin(Wire, BEAM_MUX_ADDRESS, perChannel);
+    CHECK(Log.warnings == warnings);
+    CHECK(beam.beamCount() == beams);
+    beam.initBeam();
+
+    uint32_t nacks = Wire.nacks;
+    Wire.clearRecords();
+    beam.print(texts[1]);
+    CHECK(Wire.nacks == nacks);
+
+    int channel = -1;
+    int switches = 0;
+    for (const HostBusRecord &rec : Wire.records()) {
+      if (rec.read || rec.address != BEAM_MUX_ADDRESS || !rec.length) continue;
+      uint8_t enabled = rec.data[rec.length - 1];
+      CHECK(enabled && !(enabled & (enabled - 1)));
+      CHECK(enabled != 1 << channel);
+      channel = __builtin_ctz(enabled);
+      switches++;
+    }
+    CHECK(switches >= beams / perChannel);
+    Wire.clearRecords();
+
+    auto checkText = [&](const char *text) {
+      BeamImage image;
+      beamRender(text, image);
+      for (int b = 0; b < beams; b++) {
+        for (int f = 0; f < MAXFRAME; f++) {
+          int k = f - (beams - b);
+          for (int j = 0; j < 12; j++) {
+            uint16_t expected = (0 <= k && k < image.frames) ? image.cs[k][j] : 0;
+            CHECK(chips[b].word(f, j) == expected);
+          }
+        }
+        CHECK(chips[b].ctrl[0x0B] == (b == beams - 1 ? 0x02 : 0x01));
+      }
+    };
+    checkText(texts[1]);
+
+    // a mux that NACKs the switch keeps the channel enabled before, whose
+    // beams sit at the addresses of the ones on the other channels: none
+    // of them may be written
+    uint8_t enabled = mux.channels;
+    std::vector<uint64_t> before;
+    for (AS1130Sim &chip : chips) before.push_back(chipState(chip));
+    Wire.failAddress = BEAM_MUX_ADDRESS;
+    beam.print(texts[2]);
+    int leaked = 0;
+    for (const HostBusRecord &rec : Wire.records()) {
+      if (rec.address != BEAM_MUX_ADDRESS) leaked++;
+    }
+    CHECK(leaked == 0);
+    for (int b = 0; b < beams; b++) {
+      if (enabled & (1 << (b / perChannel))) CHECK(chipState(chips[b]) == before[b]);
+    }
+
+    // once the mux answers again the beams that missed the text catch up
+    Wire.failAddress = 0;
+    Wire.clearRecords();
+    beam.print(texts[2]);
+    for (int b = 0; b < beams; b++) CHECK(beam.isOnline(b));
+    checkText(texts[2]);
+  }
+
+  for (AS1130Sim &chip : chips) mux.detach(&chip);
+  chips.clear();
+  for (int c = 0; c < BEAM_MUX_CHANNELS; c++) {
+    chips.emplace_back(BEAMA, RSTPIN, IRQPIN);
+    mux.attach(c, &chips.back());
+  }
+
+  {
+    Beam beam(RSTPIN, IRQPIN, MAXBEAMS);
+    uint32_t warnings = Log.warnings;
+    beam.begin(Wire, BEAM_MUX_ADDRESS, 1);
+    CHECK(Log.warnings == warnings + 1);
+    CHECK(beam.beamCount() == BEAM_MUX_CHANNELS);
+  }
+
+  for (AS1130Sim &chip : chips) mux.detach(&chip);
+  Wire.detach(&mux);
+}
+
+/*
+Largest number of frames two units of a single beam, one oscillator 0.2%
+slow and the other 0.2% fast, are apart over two minutes, with a BeamSync
+in mode unless mode is -1. realignments gets the restarts it needed.
+*/
+static int unitOffset(int mode, uint32_t &realignments) {
+  AS1130Sim slow(BEAMA, RSTPIN, IRQPIN);
+  AS1130Sim fast(BEAMB, RSTPIN, IRQPIN);
+  slow.drift = 2000;
+  fast.drift = -2000;
+  Wire.attach(&slow);
+  Wire.attach(&fast);
+  Wire.setRecording(false);
+
+  int offset = 0;
+  {
+    Beam left(RSTPIN, IRQPIN, SYNC_OFF, BEAMA);
+    Beam right(RSTPIN, IRQPIN, SYNC_OFF, BEAMB);
+    left.begin();
+    right.begin();
+    left.draw();
+    right.draw();
+    left.play();
+    right.play();
+
+    BeamSync sync(mode == -1 ? SYNC_TIMER : mode);
+    if (mode != -1) {
+      CHECK(sync.add(left) && sync.add(right));
+      sync.start();
+    }
+    for (uint32_t t = 0; t < 120000; t++) {
+      sync.update();
+      delay(1);
+      if (t < 5000 || t % 500) continue;
+      // frames on display, both movies loop over all 36
+      int d = abs(slow.frameOnDisplay() - fast.frameOnDisplay());
+      if (d > MAXFRAME / 2) d = MAXFRAME - d;
+      if (d > offset) offset = d;
+    }
+    CHECK(slow.running() && fast.running());
+    realignments = sync.realignments();
+  }
+
+  Wire.setRecording(true);
+  Wire.detach(&slow);
+  Wire.detach(&fast);
+  return offset;
+}
+
+/*
+Units left alone drift apart; SYNC_TIMER steps them together and with
+SYNC_CLOCK the slave runs on the oscillator of the master, so neither
+needs a restart (an offset of 1 is a check falling between the steps of
+the two)
+*/
+static void sync_units() {
+  uint32_t realignments;
+  CHECK(unitOffset(-1, realignments) > 2);
+  CHECK(unitOffset(SYNC_TIMER, realignments) == 0);
+  CHECK(realignments == 0);
+  CHECK(unitOffset(SYNC_CLOCK, realignments) <= 1);
+  CHECK(realignments == 0);
+}
+
+/*
+bindFrame() moves a frame to another PWM set on every beam right away,
+also on a chain spread over two buses where frames wait to be uploaded on
+both at once
+*/
+static void bind_frame() {
+  const int beams = 4;
+  for (int onWire : { beams, beams / 2 }) {
+    Chain chain(beams, onWire);
+    Beam beam(RSTPIN, IRQPIN, beams);
+    if (onWire < beams) beam.begin(Wire, Wire1, onWire);
+    else beam.begin();
+    beam.initBeam();
+    beam.print(texts[1]);
+
+    std::vector<AS1130Sim> before = chain.chips;
+    beam.bindFrame(7, 3);
+    for (int c = 0; c < beams; c++) {
+      const AS1130Sim &chip = chain.chips[c];
+      CHECK(chip.frame[7][1] >> 5 == 3);
+      CHECK((chip.frame[7][1] & 0x1F) == (before[c].frame[7][1] & 0x1F));
+      CHECK(!memcmp(chip.frame[0], before[c].frame[0], sizeof(chip.frame[0]) * 7));
+    }
+
+    // frames written later on keep the binding
+    beam.print(texts[4]);
+    for (const AS1130Sim &chip : chain.chips) CHECK(chip.frame[7][1] >> 5 == 3);
+  }
+}
+
+/*
+loadBank() loops bank A, and a bank loaded while it plays takes over at
+the end of a loop, on every beam at its own boundary: the bank on display
+is never cut short and the next one starts at its first frame, whether
+the switch is polled or raised on IRQ_FRAME
+*/
+static void bank_switch() {
+  const int beams = 2;
+  const int frames[] = { 4, 5, 3 };      // banks A, B, A again
+
+  // frame i of load n shows column 0 = i + 1 and column 1 = n
+  std::vector<std::vector<uint8_t>> loads;
+  for (int n = 0; n < 3; n++) {
+    std::vector<uint8_t> columns(frames[n] * BEAM_COLUMNS, 0);
+    for (int i = 0; i < frames[n]; i++) {
+      columns[i * BEAM_COLUMNS] = i + 1;
+      columns[i * BEAM_COLUMNS + 1] = n;
+    }
+    loads.push_back(columns);
+  }
+
+  for (uint8_t handoff : { HANDOFF_POLL, HANDOFF_IRQ }) {
+    Chain chain(beams);
+    Beam beam(RSTPIN, IRQPIN, beams);
+    beam.begin();
+    beam.setHandoff(handoff);
+
+    // frames as they come on display, as load * 100 + index, -1 if the
+    // content doesn't fit the frame number
+    std::vector<std::vector<int>> shown(beams);
+    auto run = [&](int ms) {
+      for (int t = 0; t < ms; t++) {
+        beam.updateBanks();
+        delay(1);
+        for (int c = 0; c < beams; c++) {
+          AS1130Sim &chip = chain.chips[c];
+          uint8_t f = chip.frameOnDisplay();
+          uint16_t word = chip.word(f, 0);
+          int i = (word & 0x1F) - 1;
+          int n = word >> 5;
+          int first = (n == 1) ? BEAM_BANK_FRAMES : 0;
+          int label = (n < 3 && 0 <= i && f == first + i) ? n * 100 + i : -1;
+          if (shown[c].empty() || shown[c].back() != label) shown[c].push_back(label);
+        }
+      }
+    };
+
+    CHECK(beam.loadBank(loads[0].data(), frames[0]));
+    run(1000);
+    for (int n = 1; n < 3; n++) {
+      CHECK(beam.loadBank(loads[n].data(), frames[n]));
+      // the switch is still to come
+      CHECK(!beam.loadBank(loads[n].data(), frames[n]));
+      run(1500);
+    }
+
+    for (int c = 0; c < beams; c++) {
+      int n = 0;
+      int loops = 0;
+      for (size_t k = 0; k < shown[c].size(); k++) {
+        int label = shown[c][k];
+        CHECK(label >= 0);
+        if (!k) {
+          CHECK(label == 0);
+          continue;
+        }
+        int prev = shown[c][k - 1];
+        if (label / 100 == n) {
+          CHECK(label % 100 == (prev % 100 + 1) % frames[n]);
+          if (label % 100 == 0) loops++;
+        }
+        else {
+          // the old bank played to its end, the new one starts at its beginning
+          CHECK(label / 100 == n + 1 && label % 100 == 0);
+          CHECK(prev % 100 == frames[n] - 1);
+          CHECK(loops > 0);
+          n++;
+          loops = 0;
+        }
+      }
+      CHECK(n == 2 && loops > 0);
+    }
+  }
+}
+
+/*
+Stream handing out the bytes of data up to limit, which the test moves on
+as if they arrived over time
+*/
+struct ByteStream : public Stream {
+  std::vector<uint8_t> data;
+  size_t pos = 0;
+  size_t limit = 0;
+
+  int available() override { return limit > pos ? limit - pos : 0; }
+  int read() override { return available() ? data[pos++] : -1; }
+  int peek() override { return available() ? data[pos] : -1; }
+};
+
+/*
+Animations of random frames come back out of BeamAnimation as they went
+into beamEncodeAnimation(): frames that stay the same, change a few
+columns or all of them, with runs longer than a token takes, from memory
+and from a stream that delivers a byte at a time. Memory cut within a
+frame ends the animation there, a stream cut there waits for the rest.
+*/
+static void animation_roundtrip() {
+  uint32_t seed = 11;
+  auto random = [&]() { return (seed = seed * 1103515245 + 12345) >> 16; };
+
+  for (uint8_t width : { 1, 3, 6 }) {
+    const int total = BEAM_COLUMNS * width;
+    const int frames = 24;
+    std::vector<uint8_t> columns(frames * total);
+    std::vector<uint8_t> times(frames);
+    for (int f = 0; f < frames; f++) {
+      uint8_t *frame = &columns[f * total];
+      if (f) memcpy(frame, frame - total, total);
+      switch (f % 4) {
+        case 0:                 // all new
+          for (int x = 0; x < total; x++) frame[x] ^= 1 + random() % 31;
+          break;
+        case 1:                 // a few columns
+          for (int n = 0; n < 5; n++) frame[random() % total] ^= 1 << (random() % 5);
+          break;
+        case 2:                 // a block
+          for (int x = random() % total; x < total; x += 2) frame[x] = random() & 0x1F;
+          break;
+        default:                // unchanged
+          break;
+      }
+      times[f] = (f % 3) ? random() % 50 : 0;
+    }
+
+    const uint8_t time = 7;
+    std::vector<uint8_t> out(BEAM_ANIMATION_HEADER + frames * 2 * (total + 1));
+    size_t length = beamEncodeAnimation(columns.data(), frames, width, times.data(), time,
+                                        BEAM_ANIMATION_LOOP, out.data(), out.size());
+    CHECK(length > BEAM_ANIMATION_HEADER);
+    CHECK(beamEncodeAnimation(columns.data(), frames, width, times.data(), time,
+                              BEAM_ANIMATION_LOOP, out.data(), length - 1) == 0);
+
+    // end of every frame in the encoded data, the header tells the frames
+    std::vector<size_t> ends;
+    for (int f = 1; f <= frames; f++) {
+      ends.push_back(beamEncodeAnimation(columns.data(), f, width, times.data(), time,
+                                         BEAM_ANIMATION_LOOP, out.data(), out.size()));
+    }
+    beamEncodeAnimation(columns.data(), frames, width, times.data(), time,
+                        BEAM_ANIMATION_LOOP, out.data(), out.size());
+    CHECK(ends.back() == length);
+
+    auto decoded = [&](BeamAnimation &animation, int f, int ms) {
+      CHECK(ms == (times[f] ? times[f] : time) * 10);
+      CHECK(!memcmp(animation.columns(), &columns[f * total], total));
+    };
+
+    BeamAnimation memory(out.data(), length);
+    for (int f = 0; f < frames; f++) decoded(memory, f, memory.nextFrame());
+    CHECK(memory.width() == width && memory.frames() == frames && memory.loop());
+    CHECK(memory.nextFrame() == -1);
+    CHECK(memory.rewind());
+    decoded(memory, 0, memory.nextFrame());
+
+    ByteStream stream;
+    stream.data.assign(out.begin(), out.begin() + length);
+    BeamAnimation streamed(stream);
+    for (int f = 0; f < frames; f++) {
+      int ms;
+      while ((ms = streamed.nextFrame()) == 0) {
+        CHECK(stream.limit < length);
+        stream.limit++;
+      }
+      decoded(streamed, f, ms);
+    }
+    CHECK(streamed.nextFrame() == -1);
+
+    for (int cut : { 0, frames / 2, frames - 1 }) {
+      size_t start = cut ? ends[cut - 1] : BEAM_ANIMATION_HEADER;
+      size_t middle = start + (ends[cut] - start) / 2;
+
+      BeamAnimation truncated(out.data(), middle);
+      for (int f = 0; f < cut; f++) decoded(truncated, f, truncated.nextFrame());
+      CHECK(truncated.nextFrame() == -1);
+
+      ByteStream partial;
+      partial.data.assign(out.begin(), out.begin() + length);
+      partial.limit = middle;
+      BeamAnimation waiting(partial);
+      for (int f = 0; f < cut; f++) decoded(waiting, f, waiting.nextFrame());
+      CHECK(waiting.nextFrame() == 0);
+      CHECK(waiting.nextFrame() == 0);
+      partial.limit = length;
+      for (int f = cut; f < frames; f++) decoded(waiting, f, waiting.nextFrame());
+      CHECK(waiting.nextFrame() == -1);
+    }
+  }
+}
+
+/*
+scrollText() moves the text one column per step across the chain as
+updateScroll() finds the steps due, and a loop() that comes back late
+skips the steps it missed rather than slowing the text down, counting
+them in droppedSteps(). Without loop the chain ends up blank.
+*/
+static void scroll_text() {
+  const int beams = 3;
+  const int width = beams * BEAM_COLUMNS;
+  const uint8_t fps = 50;
+  const uint32_t period = 1000000 / fps;
+  const char *text = "Beam 123";
+
+  // columns moving in: the text, then the chain width in blank ones
+  std::vector<uint8_t> stream;
+  for (const uint8_t *c = (const uint8_t *)text; *c; c++) {
+    for (const uint8_t *g = beamGlyph(*c); *g != 0xFF; g++) stream.push_back(*g);
+  }
+  stream.resize(stream.size() + width, 0x00);
+  const uint32_t cycle = stream.size();
+
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin();
+  beam.initBeam();
+
+  // whether the chain shows what it should after the given steps, column x
+  // of the chain showing column steps - width + x of the stream
+  auto shows = [&](uint32_t steps) {
+    for (int b = 0; b < beams; b++) {
+      uint8_t columns[BEAM_COLUMNS];
+      for (int x = 0; x < BEAM_COLUMNS; x++) {
+        int32_t k = (int32_t)steps - width + b * BEAM_COLUMNS + x;
+        columns[x] = k < 0 ? 0x00 : stream[k % cycle];
+      }
+      uint16_t words[12];
+      beamPackColumns(columns, words);
+      AS1130Sim &chip = chain.chips[b];
+      uint8_t f = chip.frameOnDisplay();
+      for (int j = 0; j < 12; j++) {
+        if (chip.word(f, j) != words[j]) return false;
+      }
+    }
+    return true;
+  };
+
+  // the first step is due when scrollText() starts, which is only known to
+  // lie between these two and narrows down as the steps show
+  uint32_t early = micros();
+  beam.scrollText(text, fps);
+  uint32_t late = micros();
+  CHECK(shows(0));
+
+  uint32_t known = 0;           // steps shown at the last poll, 0 if unsure
+  uint32_t dropped = 0;
+  int polls = 0;
+  int unsure = 0;
+  auto poll = [&]() {
+    uint32_t t = micros();
+    uint32_t before = beam.droppedSteps();
+    CHECK(beam.updateScroll());
+    uint32_t fewest = (t - late) / period + 1;
+    uint32_t most = (t - early) / period + 1;
+    bool isFewest = shows(fewest);
+    bool isMost = shows(most);
+    CHECK(isFewest || isMost);
+    polls++;
+    if (fewest != most && isFewest == isMost) {
+      unsure++;
+      known = 0;
+      return;
+    }
+
+    uint32_t steps = isFewest ? fewest : most;
+    early = std::max(early, t - steps * period + 1);
+    late = std::min(late, t - (steps - 1) * period);
+    if (known) {
+      uint32_t skipped = steps > known ? steps - known - 1 : 0;
+      CHECK(beam.droppedSteps() - before == skipped);
+      dropped += skipped;
+    }
+    known = steps;
+  };
+
+  // polled often enough every step comes on display, all the text and
+  // into the next round
+  while (micros() - early < (cycle + cycle / 2) * period) {
+    poll();
+    delay(1);
+  }
+  CHECK(beam.droppedSteps() == 0);
+
+  // late polls skip to where the text should be by then
+  for (int n = 1; n <= 6; n++) {
+    delay(n * period / 1000 + period / 2000);
+    poll();
+    for (int k = 0; k < 30; k++) {
+      delay(1);
+      poll();
+    }
+  }
+  CHECK(dropped > 0);
+  CHECK(beam.droppedSteps() >= dropped);
+  CHECK(unsure < polls / 10);
+
+  // once round, then the chain stays blank
+  uint32_t start = micros();
+  beam.scrollText(text, fps, false);
+  while (beam.updateScroll() && micros() - start < 2 * cycle * period) delay(1);
+  CHECK(!beam.updateScroll());
+  CHECK(micros() - start >= (cycle - 1) * period);
+  CHECK(micros() - start < (cycle + 1) * period);
+  for (AS1130Sim &chip : chain.chips) {
+    uint8_t f = chip.frameOnDisplay();
+    for (int j = 0; j < 12; j++) CHECK(chip.word(f, j) == 0);
+  }
+}
+
+/*
+On a bus that fails above 400 kHz the adaptive clock steps down from
+1 MHz and stays there while it runs clean, tries 1 MHz again after
+BEAM_CLOCK_CLEAN ms and comes back down. Without adaptive the bus keeps
+its clock and the retries carry the chain. Either way the chips end up
+as on a clean bus.
+*/
+static void clock_adapt() {
+  const int beams = 2;
+  uint64_t clean;
+  {
+    Chain chain(beams);
+    Beam beam(RSTPIN, IRQPIN, beams);
+    beam.begin();
+    beam.initBeam();
+    beam.print(texts[1]);
+    clean = chainState(chain.chips);
+  }
+
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  Wire.flakyAbove = 400000;
+  Wire.nacks = 0;
+  beam.begin(Wire, CLOCK_FAST_PLUS, true);
+  CHECK(beam.busClock() == 1000000);
+  beam.initBeam();
+  beam.print(texts[1]);
+  CHECK(Wire.nacks > 0);
+  CHECK(beam.busClock() == 400000);
+  CHECK(chainState(chain.chips) == clean);
+
+  uint32_t nacks = Wire.nacks;
+  beam.print(texts[4]);
+  beam.print(texts[1]);
+  CHECK(Wire.nacks == nacks);
+  CHECK(beam.busClock() == 400000);
+  CHECK(chainState(chain.chips) == clean);
+
+  delay(BEAM_CLOCK_CLEAN);
+  beam.print(texts[4]);
+  beam.print(texts[1]);
+  CHECK(Wire.nacks > nacks);
+  CHECK(beam.busClock() == 400000);
+  CHECK(chainState(chain.chips) == clean);
+
+  beam.setBusClock(CLOCK_FAST_PLUS);
+  nacks = Wire.nacks;
+  beam.print(texts[4]);
+  beam.print(texts[1]);
+  CHECK(Wire.nacks > nacks);
+  CHECK(beam.busClock() == 1000000);
+  CHECK(chainState(chain.chips) == clean);
+
+  Wire.flakyAbove = 0;
+  beam.setBusClock(CLOCK_STANDARD);
+}
+
+/*
+present() shows the canvas on picture frame 0 of every beam. Drawing on
+one beam only sends frame data to that beam, presenting an unchanged
+canvas sends nothing, and after other content all of it goes up again.
+*/
+static void canvas_present() {
+  const int beams = 3;
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin();
+  beam.initBeam();
+  beam.print(texts[1]);
+
+  BeamCanvas canvas(beams);
+  auto shown = [&]() {
+    for (int b = 0; b < beams; b++) {
+      AS1130Sim &chip = chain.chips[b];
+      uint8_t f = chip.frameOnDisplay();
+      CHECK(f == 0);
+      for (int x = 0; x < BEAM_COLUMNS; x++) {
+        for (int y = 0; y < BEAM_ROWS; y++) {
+          CHECK(chip.led(f, x, y) == canvas.getPixel(b * BEAM_COLUMNS + x, y));
+        }
+      }
+    }
+  };
+
+  canvas.text(3, texts[0]);
+  canvas.hline(0, 4, canvas.width());
+  canvas.vline(40, 0, 5);
+  beam.present(canvas);
+  delay(100);
+  shown();
+
+  Wire.clearRecords();
+  canvas.setPixel(BEAM_COLUMNS + 5, 2, !canvas.getPixel(BEAM_COLUMNS + 5, 2));
+  beam.present(canvas);
+  // one byte of a CS register, to the beam drawn on only
+  CHECK(frameWrites(chain.chips) == 1);
+  for (const HostBusRecord &rec : Wire.records()) CHECK(rec.address == chain.chips[1].address());
+  shown();
+
+  Wire.clearRecords();
+  beam.present(canvas);
+  CHECK(Wire.records().empty());
+
+  beam.print(texts[4]);
+  beam.present(canvas);
+  delay(100);
+  shown();
+}
+
+/*
+setLevels() puts the level of every pixel into its PWM byte of the set on
+the chip of its beam, through the gamma table if there is one, on one bus
+or two. Changing one pixel sends that byte alone.
+*/
+static void pwm_levels() {
+  const int beams = 4;
+  const int width = beams * BEAM_COLUMNS;
+  uint32_t seed = 5;
+  auto random = [&]() { return (seed = seed * 1103515245 + 12345) >> 16; };
+
+  for (int onWire : { beams, beams / 2 }) {
+    Chain chain(beams, onWire);
+    Beam beam(RSTPIN, IRQPIN, beams);
+    if (onWire < beams) beam.begin(Wire, Wire1, onWire);
+    else beam.begin();
+    beam.initBeam();
+    beam.print(texts[1]);
+
+    std::vector<uint8_t> levels(width * BEAM_ROWS);
+    for (uint8_t &level : levels) level = random();
+    auto uploaded = [&](uint8_t set, const uint8_t *lut) {
+      for (int b = 0; b < beams; b++) {
+        for (int x = 0; x < BEAM_COLUMNS; x++) {
+          for (int y = 0; y < BEAM_ROWS; y++) {
+            uint8_t level = levels[y * width + b * BEAM_COLUMNS + x];
+            int i = BEAM_PWM_BASE + (x / 2) * 11 + (x % 2) * 5 + y;
+            CHECK(chain.chips[b].sets[set][i] == (lut ? lut[level] : level));
+          }
+        }
+      }
+    };
+
+    std::vector<AS1130Sim> before = chain.chips;
+    beam.setLevels(3, levels.data(), width);
+    uploaded(3, NULL);
+    for (int c = 0; c < beams; c++) {
+      for (int s = 0; s < AS1130Sim::SETS; s++) {
+        if (s != 3) CHECK(!memcmp(chain.chips[c].sets[s], before[c].sets[s], AS1130Sim::SET_SIZE));
+      }
+      CHECK(!memcmp(chain.chips[c].frame, before[c].frame, sizeof(before[c].frame)));
+    }
+
+    Wire.clearRecords();
+    levels[2 * width + BEAM_COLUMNS + 7] ^= 0x55;
+    beam.setLevels(3, levels.data(), width);
+    uploaded(3, NULL);
+    if (onWire == beams) {
+      // the byte, after REGSEL if that selects something else by now
+      const std::vector<HostBusRecord> &records = Wire.records();
+      CHECK(!records.empty() && records.size() <= 2);
+      for (const HostBusRecord &rec : records) CHECK(rec.address == chain.chips[1].address());
+      if (!records.empty()) {
+        const HostBusRecord &last = records.back();
+        CHECK(last.length == 2 && last.data[0] == BEAM_PWM_BASE + 3 * 11 + 5 + 2);
+        CHECK(last.data[1] == levels[2 * width + BEAM_COLUMNS + 7]);
+      }
+    }
+
+    uint8_t lut[256];
+    for (int i = 0; i < 256; i++) lut[i] = (uint8_t)(powf(i / 255.0f, 2.2f) * 255.0f + 0.5f);
+    beam.setGamma(2.2f);
+    beam.setLevels(5, levels.data(), width);
+    uploaded(5, lut);
+    uploaded(3, NULL);
+    beam.setGamma(1.0f);
+  }
+}
+
+/*
+BeamRenderCache hands out the image beamRender() gives, renders a text
+only on a miss and drops the least recently used entry for a new one.
+Texts too long to keep go to the scratch image of their own cache. print()
+goes through the cache set with setRenderCache().
+*/
+static void render_cache() {
+  auto same = [](const BeamImage *image, const char *text, uint8_t maxFrames) {
+    BeamImage expected;
+    beamRender(text, expected, maxFrames);
+    CHECK(image->frames == expected.frames && image->fullFrames == expected.fullFrames);
+    CHECK(!memcmp(image->cs, expected.cs, sizeof(expected.cs[0]) * expected.frames));
+  };
+
+  BeamRenderCache cache(3000);
+  const int n = cache.capacity();
+  CHECK(n >= 2);
+  std::vector<std::string> keep;
+  for (int k = 0; k <= n; k++) keep.push_back("TEXT " + std::to_string(k));
+  std::string longer(BEAM_CACHE_TEXT, 'X');
+
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  auto render = [&](const std::string &text, bool hit, uint8_t maxFrames = MAXFRAME) {
+    const BeamImage *image = cache.render(text.c_str(), maxFrames);
+    (hit ? hits : misses)++;
+    CHECK(cache.hits() == hits && cache.misses() == misses);
+    same(image, text.c_str(), maxFrames);
+    return image;
+  };
+
+  const BeamImage *first = render(keep[0], false);
+  for (int k = 1; k < n; k++) render(keep[k], false);
+  CHECK(render(keep[0], true) == first);
+
+  // keep[1] is the least recently used now and makes room for keep[n]
+  render(keep[n], false);
+  render(keep[0], true);
+  for (int k = 2; k <= n; k++) render(keep[k], true);
+  render(keep[1], false);
+
+  // the frame limit is part of the key
+  render(keep[0], false, 2);
+  render(keep[0], false);
+
+  // too long to keep, the entries stay as they are
+  render(longer, false);
+  render(longer, false);
+  render(keep[0], true);
+
+  // each cache has its own scratch image
+  std::string other(BEAM_CACHE_TEXT, 'O');
+  BeamRenderCache second(3000);
+  const BeamImage *mine = cache.render(longer.c_str());
+  second.render(other.c_str());
+  same(mine, longer.c_str(), MAXFRAME);
+
+  cache.clear();
+  misses = cache.misses();
+  render(keep[0], false);
+
+  const int beams = 2;
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin();
+  beam.setRenderCache(3000);
+  beam.initBeam();
+  beam.print(texts[1]);
+  uint64_t state = chainState(chain.chips);
+  beam.print(texts[4]);
+  beam.print(texts[1]);
+  CHECK(chainState(chain.chips) == state);
+  CHECK(beam.renderCache()->hits() == 1 && beam.renderCache()->misses() == 2);
+}
+
+/*
+With HANDOFF_IRQ and no queue play() only starts the last beam, and every
+beam raises IRQ at its handoff frame for the IRQ timer to start the one
+before it within a millisecond. Nothing polls STATUS: the only reads are
+of IRQSTAT, one per handoff, and a beam that handed over stops
+interrupting.
+*/
+static void irq_handoff() {
+  const int beams = 3;
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin();
+  beam.setHandoff(HANDOFF_IRQ);
+  beam.initBeam();
+  beam.print(texts[1]);
+
+  Wire.clearRecords();
+  beam.play();
+  for (int c = 0; c < beams; c++) CHECK(chain.chips[c].running() == (c == beams - 1));
+
+  // micros() when a chip started and when it reached its handoff frame
+  std::vector<uint32_t> started(beams, 0);
+  std::vector<uint32_t> reached(beams, 0);
+  started[beams - 1] = micros();
+  for (int t = 0; t < 5000 && !started[0]; t++) {
+    delay(1);
+    for (int c = 0; c < beams; c++) {
+      AS1130Sim &chip = chain.chips[c];
+      if (!started[c] && chip.running()) started[c] = micros();
+      if (c && started[c] && !reached[c] && chip.frameOnDisplay() == beams - c) reached[c] = micros();
+    }
+  }
+  for (int c = 0; c < beams - 1; c++) {
+    CHECK(started[c] && reached[c + 1]);
+    CHECK(started[c] - reached[c + 1] <= 2000);
+  }
+
+  int reads = 0;
+  for (const HostBusRecord &rec : Wire.records()) reads += rec.read;
+  CHECK(reads == beams - 1);
+  for (AS1130Sim &chip : chain.chips) CHECK(chip.ctrl[IRQMASK] == 0x00);
+}
+
+/*
+busStats() counts every transaction, byte and NACK of a beam as they went
+on the bus, a missing beam shows up as NACKs and going offline, and
+latency() counts a public operation once, nested calls included, with
+the time it took on the sim clock.
+*/
+static void bus_stats() {
+  const int beams = 3;
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin();
+  beam.initBeam();
+  // begin() and initBeam()
+  CHECK(beam.latency(JOB_INIT)->count == 2);
+  CHECK(!beam.busStats(beams) && !beam.latency(BEAM_JOBS));
+
+  auto counted = [&]() {
+    for (int c = 0; c < beams; c++) {
+      BeamBusStats expected = { };
+      for (const HostBusRecord &rec : Wire.records()) {
+        if (rec.address != chain.chips[c].address()) continue;
+        expected.transactions++;
+        expected.bytes += rec.ack ? rec.length + 1 : 1;
+        expected.nacks += !rec.ack;
+      }
+      const BeamBusStats *stats = beam.busStats(c);
+      CHECK(stats->transactions == expected.transactions);
+      CHECK(stats->bytes == expected.bytes);
+      CHECK(stats->nacks == expected.nacks);
+    }
+  };
+  // total as measured around the calls, every micros() moves the host
+  // clock on by 1 us
+  auto latency = [&](uint8_t job, uint32_t count, uint32_t total) {
+    const BeamLatency *lat = beam.latency(job);
+    CHECK(lat->count == count);
+    CHECK(lat->totalMicros <= total && total - lat->totalMicros <= 2 * count);
+    uint32_t sum = 0;
+    for (int i = 0; i < BEAM_LATENCY_BUCKETS; i++) sum += lat->bucket[i];
+    CHECK(sum == count);
+  };
+
+  beam.clearStats();
+  Wire.clearRecords();
+  for (int j = 0; j < BEAM_JOBS; j++) latency(j, 0, 0);
+  counted();
+
+  uint32_t start = micros();
+  beam.print(texts[1]);
+  uint32_t took = micros() - start;
+  counted();
+  CHECK(beam.busStats(0)->transactions > 0);
+  latency(JOB_PRINT, 1, took);
+  CHECK(beam.latency(JOB_PRINT)->maxMicros == beam.latency(JOB_PRINT)->totalMicros);
+
+  start = micros();
+  beam.print(texts[4]);
+  took += micros() - start;
+  counted();
+  latency(JOB_PRINT, 2, took);
+
+  // a missing beam NACKs until it is taken offline
+  Wire.detach(&chain.chips[1]);
+  beam.print(texts[2]);
+  beam.print(texts[0]);
+  counted();
+  CHECK(beam.busStats(1)->nacks > 0);
+  CHECK(!beam.isOnline(1) && beam.busStats(1)->offline == 1);
+  CHECK(beam.busStats(0)->nacks == 0 && beam.busStats(2)->nacks == 0);
+  Wire.attach(&chain.chips[1]);
+
+  CHECK(beam.exportStats());
+  beam.clearStats();
+  for (int c = 0; c < beams; c++) CHECK(beam.busStats(c)->transactions == 0);
+  latency(JOB_PRINT, 0, 0);
+}
+
+/*
+pump() with a budget never blocks for long, also not while play() polls
+the handoff: the pause the first beam of the chain gets after its start
+is waited out over later calls, and the queue only drains after it.
+*/
+static void pump_budget() {
+  const int beams = 3;
+  Chain chain(beams);
+  Beam beam(RSTPIN, IRQPIN, beams);
+  beam.begin();
+  beam.initBeam();
+  beam.setAsync(ASYNC_PUMP);
+  beam.print(texts[1]);
+  beam.play();
+
+  uint32_t longest = 0;
+  uint32_t first = 0;           // micros() before the call that started the first beam
+  uint32_t drained = 0;
+  for (int t = 0; t < 5000 && !drained; t++) {
+    uint32_t start = micros();
+    bool done = beam.pump(2000);
+    longest = std::max(longest, micros() - start);
+    if (!first && chain.chips[0].running()) first = start;
+    if (done) drained = micros();
+    delay(1);
+  }
+  CHECK(drained);
+  for (AS1130Sim &chip : chain.chips) CHECK(chip.running());
+  CHECK(first && drained - first >= 10000);
+  // the budget and at most one frame upload past it
+  CHECK(longest < 5000);
+}
+
+static const struct {
+  const char *name;
+  void (*run)();
+} tests[] = {
+  { "print_baseline", print_baseline },
+  { "print_warm", print_warm },
+  { "async_equal", async_equal },
+  { "two_bus_equal", two_bus_equal },
+  { "two_bus_errors", two_bus_errors },
+  { "stream_order", stream_order },
+  { "offline_recovery", offline_recovery },
+  { "missed_write", missed_write },
+  { "render_legacy", render_legacy },
+  { "convert_frames", convert_frames },
+  { "pack_columns", pack_columns },
+  { "mux_layout", mux_layout },
+  { "sync_units", sync_units },
+  { "bind_frame", bind_frame },
+  { "bank_switch", bank_switch },
+  { "animation_roundtrip", animation_roundtrip },
+  { "scroll_text", scroll_text },
+  { "clock_adapt", clock_adapt },
+  { "canvas_present", canvas_present },
+  { "pwm_levels", pwm_levels },
+  { "render_cache", render_cache },
+  { "irq_handoff", irq_handoff },
+  { "bus_stats", bus_stats },
+  { "pump_budget", pump_budget },
+};
+
+int main(int argc, char **argv) {
+  // failures provoked by the tests are expected
+  Log.level = LOG_LEVEL_NONE;
+  Wire.setRecording(true);
+
+  bool found = false;
+  for (const auto &test : tests) {
+    if (argc > 1 && strcmp(argv[1], test.name)) continue;
+    found = true;
+    int before = failures;
+    test.run();
+    printf("%-20s %s\n", test.name, failures == before ? "ok" : "FAILED");
+  }
+  if (!found) {
+    printf("no test %s\n", argv[1]);
+    return 1;
+  }
+  return failures;
+}
+
+#endif
@@ -0,0 +1,395 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+===========================================================================
+*/
+#if !defined(PLATFORM_ID)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include "Particle.h"
+
+TwoWire Wire;
+TwoWire Wire1;
+Logger Log;
+CloudClass Particle;
+
+static std::atomic<uint64_t> hostClock(0);      // simulated time in us
+static std::map<int, int> pinLevels;
+static std::map<int, std::function<void()> > pinHandlers;
+static std::vector<Timer *> timers;
+
+static void tickDevices() {
+  uint32_t now = (uint32_t)hostClock;
+  for (HostI2CDevice *device : Wire.devices()) device->tick(now);
+  for (HostI2CDevice *device : Wire1.devices()) device->tick(now);
+}
+
+void hostAdvance(uint32_t us) {
+  hostClock += us;
+}
+
+void hostInterrupt(int pin) {
+  auto handler = pinHandlers.find(pin);
+  if (handler != pinHandlers.end() && handler->second) handler->second();
+}
+
+uint32_t millis() {
+  hostClock++;
+  return (uint32_t)(hostClock / 1000);
+}
+
+uint32_t micros() {
+  hostClock++;
+  return (uint32_t)hostClock;
+}
+
+/*
+Moves the clock in steps of at most a millisecond, so timers and devices
+see time pass the way they would on the device
+*/
+void delayMicroseconds(uint32_t us) {
+  uint64_t until = hostClock + us;
+  while (hostClock < until) {
+    hostClock = std::min<uint64_t>(until, hostClock.load() + 1000);
+    tickDevices();
+    Timer::runDue((uint32_t)hostClock);
+  }
+}
+
+void delay(uint32_t ms) {
+  delayMicroseconds(ms * 1000);
+}
+
+void pinMode(int pin, int mode) {
+  if (mode == INPUT_PULLUP && !pinLevels.count(pin)) pinLevels[pin] = HIGH;
+}
+
+void digitalWrite(int pin, int value) {
+  pinLevels[pin] = value;
+  for (HostI2CDevice *device : Wire.devices()) device->pinChanged(pin, value);
+  for (HostI2CDevice *device : Wire1.devices()) device->pinChanged(pin, value);
+}
+
+int digitalRead(int pin) {
+  auto level = pinLevels.find(pin);
+  return level != pinLevels.end() ? level->second : LOW;
+}
+
+bool attachInterrupt(int pin, std::function<void()> handler, int /* mode */) {
+  pinHandlers[pin] = handler;
+  return true;
+}
+
+void detachInterrupt(int pin) {
+  pinHandlers.erase(pin);
+}
+
+/*
+TwoWire
+*/
+TwoWire::TwoWire() {
+  transactions = 0;
+  bytes = 0;
+  nacks = 0;
+  resets = 0;
+  busMicros = 0;
+  flakyAbove = 0;
+  failAddress = 0;
+  _flakyCount = 0;
+  _recording = false;
+  _enabled = false;
+  _clock = CLOCK_SPEED_100KHZ;
+  _address = 0;
+  _txLength = 0;
+  _rxLength = 0;
+  _rxPos = 0;
+}
+
+void TwoWire::begin() {
+  _enabled = true;
+}
+
+void TwoWire::end() {
+  _enabled = false;
+}
+
+bool TwoWire::isEnabled() {
+  return _enabled;
+}
+
+void TwoWire::setSpeed(uint32_t clock) {
+  _clock = clock;
+}
+
+void TwoWire::reset() {
+  resets++;
+}
+
+bool TwoWire::lock() {
+  return true;
+}
+
+void TwoWire::unlock() {
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  _address = address;
+  _txLength = 0;
+}
+
+void TwoWire::beginTransmission(int address) {
+  beginTransmission((uint8_t)address);
+}
+
+size_t TwoWire::write(uint8_t data) {
+  if (_txLength >= I2C_BUFFER_LENGTH) return 0;
+  _tx[_txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t len) {
+  size_t written = 0;
+  while (len-- && write(*data++)) written++;
+  return written;
+}
+
+/*
+Returns 0 on success and 2 (address NACK) when no device has the address,
+like the device implementation
+*/
+uint8_t TwoWire::endTransmission(uint8_t /* stop */) {
+  HostI2CDevice *device = find(_address);
+  record(_address, false, device != NULL, _tx, _txLength);
+  if (!device) return 2;
+  if ((flakyAbove && _clock > flakyAbove && ++_flakyCount % 8 == 0)
+   || (failAddress && _address == failAddress)) {
+    nacks++;
+    return 3;
+  }
+
+  device->write(_tx, _txLength);
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t /* stop */) {
+  HostI2CDevice *device = find(address);
+  if (quantity > I2C_BUFFER_LENGTH) quantity = I2C_BUFFER_LENGTH;
+
+  _rxLength = 0;
+  _rxPos = 0;
+  if (device) {
+    while (_rxLength < quantity) _rx[_rxLength++] = device->read();
+  }
+  record(address, true, device != NULL, _rx, device ? quantity : 0);
+  return _rxLength;
+}
+
+int TwoWire::available() {
+  return _rxLength - _rxPos;
+}
+
+int TwoWire::read() {
+  return _rxPos < _rxLength ? _rx[_rxPos++] : -1;
+}
+
+void TwoWire::attach(HostI2CDevice *device) {
+  _devices.push_back(device);
+}
+
+void TwoWire::detach(HostI2CDevice *device) {
+  _devices.erase(std::remove(_devices.begin(), _devices.end(), device), _devices.end());
+}
+
+const std::vector<HostI2CDevice *> &TwoWire::devices() const {
+  return _devices;
+}
+
+float TwoWire::busTime(size_t len, uint32_t clock) {
+  return (2 + 9.0f * (len + 1)) * 1e6f / clock;
+}
+
+void TwoWire::setRecording(bool on) {
+  _recording = on;
+}
+
+const std::vector<HostBusRecord> &TwoWire::records() const {
+  return _records;
+}
+
+void TwoWire::clearRecords() {
+  _records.clear();
+}
+
+HostI2CDevice *TwoWire::find(uint8_t address) {
+  for (HostI2CDevice *device : _devices) {
+    HostI2CDevice *target = device->route(address);
+    if (target) return target;
+  }
+  return NULL;
+}
+
+/*
+Accounts for a transaction and lets the clock run for its bus time. A
+NACKed transaction still takes the address byte on the wire.
+*/
+void TwoWire::record(uint8_t address, bool read, bool ack, const uint8_t *data, uint8_t len) {
+  float us = busTime(ack ? len : 0, _clock);
+
+  if (_recording) {
+    HostBusRecord rec;
+    rec.at = (uint32_t)hostClock;
+    rec.address = address;
+    rec.read = read;
+    rec.ack = ack;
+    rec.length = len;
+    memcpy(rec.data, data, len);
+    rec.us100 = busTime(ack ? len : 0, CLOCK_SPEED_100KHZ);
+    rec.us400 = busTime(ack ? len : 0, CLOCK_SPEED_400KHZ);
+    _records.push_back(rec);
+  }
+
+  transactions++;
+  bytes += (ack ? len : 0) + 1;
+  if (!ack) nacks++;
+  busMicros += us;
+  hostClock += (uint64_t)us;
+}
+
+/*
+Logger
+*/
+Logger::Logger() {
+  level = LOG_LEVEL_WARN;
+  warnings = 0;
+}
+
+#define LOG_AT(lvl, tag) \
+  if (level > lvl) return; \
+  va_list args; \
+  va_start(args, format); \
+  fprintf(stderr, "%010u [%s] ", (unsigned)(hostClock / 1000), tag); \
+  vfprintf(stderr, format, args); \
+  fputc('\n', stderr); \
+  va_end(args);
+
+void Logger::trace(const char *format, ...) { LOG_AT(LOG_LEVEL_TRACE, "trace") }
+void Logger::info(const char *format, ...)  { LOG_AT(LOG_LEVEL_INFO, "info") }
+void Logger::warn(const char *format, ...)  { warnings++; LOG_AT(LOG_LEVEL_WARN, "warn") }
+void Logger::error(const char *format, ...) { LOG_AT(LOG_LEVEL_ERROR, "error") }
+
+void CloudClass::process() {
+  delay(1);
+}
+
+bool CloudClass::connected() {
+  return false;
+}
+
+/*
+Timer
+*/
+Timer::Timer(unsigned int period, std::function<void()> callback, bool oneShot) {
+  _callback = callback;
+  _period = period;
+  _oneShot = oneShot;
+  _active = false;
+  _due = 0;
+  timers.push_back(this);
+}
+
+Timer::~Timer() {
+  timers.erase(std::remove(timers.begin(), timers.end(), this), timers.end());
+}
+
+bool Timer::start() {
+  _active = true;
+  _due = (uint32_t)hostClock + _period * 1000;
+  return true;
+}
+
+bool Timer::stop() {
+  _active = false;
+  return true;
+}
+
+bool Timer::reset() {
+  return start();
+}
+
+bool Timer::changePeriod(unsigned int period) {
+  _period = period;
+  return start();
+}
+
+bool Timer::isActive() {
+  return _active;
+}
+
+void Timer::startFromISR() { start(); }
+void Timer::stopFromISR() { stop(); }
+void Timer::resetFromISR() { reset(); }
+void Timer::changePeriodFromISR(unsigned int period) { changePeriod(period); }
+
+void Timer::runDue(uint32_t now) {
+  static bool running = false;      // a callback calling delay() must not recurse
+  if (running) return;
+  running = true;
+
+  // callbacks may start, stop or delete timers
+  std::vector<Timer *> due;
+  for (Timer *timer : timers) {
+    if (timer->_active && (int32_t)(now - timer->_due) >= 0) due.push_back(timer);
+  }
+  for (Timer *timer : due) {
+    if (std::find(timers.begin(), timers.end(), timer) == timers.end()) continue;
+    if (timer->_oneShot) timer->_active = false;
+    else timer->_due = now + timer->_period * 1000;
+    timer->_callback();
+  }
+
+  running = false;
+}
+
+/*
+Semaphores
+*/
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial) {
+  *semaphore = new HostSemaphore();
+  (*semaphore)->count = initial;
+  (*semaphore)->max = max;
+  return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+  delete semaphore;
+  return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, uint32_t timeout, bool /* reserved */) {
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+  auto ready = [semaphore]() { return semaphore->count > 0; };
+  if (timeout == CONCURRENT_WAIT_FOREVER) semaphore->signal.wait(lock, ready);
+  else if (!semaphore->signal.wait_for(lock, std::chrono::milliseconds(timeout), ready)) return 1;
+  semaphore->count--;
+  return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool /* reserved */) {
+  std::lock_guard<std::mutex> lock(semaphore->mutex);
+  if (semaphore->count >= semaphore->max) return 1;
+  semaphore->count++;
+  semaphore->signal.notify_one();
+  return 0;
+}
+
+#endif
@@ -0,0 +1,76 @@
+﻿/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+===========================================================================
+*/
+#if !defined(PLATFORM_ID)
+
+#include <algorithm>
+#include "tca9548sim.h"
+
+TCA9548Sim::TCA9548Sim(uint8_t address) {
+  _address = address;
+  channels = 0;
+  switches = 0;
+}
+
+void TCA9548Sim::attach(uint8_t channel, HostI2CDevice *device) {
+  if (channel < CHANNELS) _devices[channel].push_back(device);
+}
+
+void TCA9548Sim::detach(HostI2CDevice *device) {
+  for (std::vector<HostI2CDevice *> &devices : _devices) {
+    devices.erase(std::remove(devices.begin(), devices.end(), device), devices.end());
+  }
+}
+
+uint8_t TCA9548Sim::address() const {
+  return _address;
+}
+
+void TCA9548Sim::write(const uint8_t *data, size_t len) {
+  if (!len) return;
+  channels = data[len - 1];
+  switches++;
+}
+
+uint8_t TCA9548Sim::read() {
+  return channels;
+}
+
+void TCA9548Sim::pinChanged(int pin, int level) {
+  for (std::vector<HostI2CDevice *> &devices : _devices) {
+    for (HostI2CDevice *device : devices) device->pinChanged(pin, level);
+  }
+}
+
+void TCA9548Sim::tick(uint32_t now) {
+  for (std::vector<HostI2CDevice *> &devices : _devices) {
+    for (HostI2CDevice *device : devices) device->tick(now);
+  }
+}
+
+/*
+The mux itself or the first device with that address on an enabled channel
+*/
+HostI2CDevice *TCA9548Sim::route(uint8_t address) {
+  if (address == _address) return this;
+
+  for (int c = 0; c < CHANNELS; c++) {
+    if (!(channels & (1 << c))) continue;
+    for (HostI2CDevice *device : _devices[c]) {
+      HostI2CDevice *target = device->route(address);
+      if (target) return target;
+    }
+  }
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,48 @@
+﻿#pragma once
+/*
+===========================================================================
+This is the library for Beam.
+
+Beam is a beautiful LED matrix — features 120 LEDs that displays scrolling text, animations, or custom lighting effects.
+Beam can be purchased here: http://www.hoverlabs.co
+
+Written by Emran Mahbub and Jonathan Li for Hover Labs.
+BSD license, all text above must be included in any redistribution
+
+---------------------------------------------------------------------------
+
+Model of a TCA9548A I2C multiplexer for host builds. Writing a byte to the
+mux enables the channels flagged in it, devices attached to a channel only
+answer while it is enabled. Reads return the channel byte.
+
+  TCA9548Sim mux(BEAM_MUX_ADDRESS);
+  mux.attach(4, &beamA);
+  Wire.attach(&mux);
+
+===========================================================================
+*/
+#include "Particle.h"
+
+class TCA9548Sim : public HostI2CDevice {
+public:
+  static const int CHANNELS = 8;
+
+  TCA9548Sim(uint8_t address);
+
+  void attach(uint8_t channel, HostI2CDevice *device);
+  void detach(HostI2CDevice *device);
+
+  uint8_t address() const override;
+  void write(const uint8_t *data, size_t len) override;
+  uint8_t read() override;
+  void pinChanged(int pin, int level) override;
+  void tick(uint32_t now) override;
+  HostI2CDevice *route(uint8_t address) override;
+
+  uint8_t  channels;        // enabled channels, bit per channel
+  uint32_t switches;        // writes to the channel register
+
+private:
+  uint8_t _address;
+  std::vector<HostI2CDevice *> _devices[CHANNELS];
+};